@@ -0,0 +1,78 @@
+#ifndef CLIP_H
+#define CLIP_H
+
+#include "transform.h"
+
+// Clipping in the homogeneous screen coordinates a VTM produces, before the
+// divide by h. A vertex (x, y, z, h) lands on pixel column (int)(x / h), so
+// the part of the plane that reaches the image is -h < x < cols * h and
+// -h < y < rows * h. The view of matrix_setView3D leaves the depth in the
+// canonical view volume in z, which puts the back plane at z = 1, and makes h
+// proportional to the distance in front of the eye.
+
+// Smallest h a vertex may keep, so that the divide stays finite.
+#define CLIP_NEAR_H 1e-6
+
+#define CLIP_MAX_PLANES 6
+
+// Pixels past each side of the image that the rasterizers take as they are.
+// Screen-space geometry that reaches further is clipped to this band first,
+// which keeps pixel coordinates well inside int and float precision.
+#define CLIP_GUARD_BAND 8192.0
+
+// The region a primitive is clipped to: the half-spaces
+// a x + b y + c z + d h + e >= 0, stored as {a, b, c, d, e}. e is only used
+// by the near and back planes, which hold for vertices that came from points
+// with a homogeneous coordinate of 1, and by the screen rectangles of
+// clip_rect.
+typedef struct {
+  double plane[CLIP_MAX_PLANES][5];
+  int nPlanes;
+} ClipVolume;
+
+// Scratch space for clip_polygon. Start from all zeros and keep it for as
+// many polygons as you like; the buffers only grow.
+typedef struct {
+  Point *vertex[2];
+  unsigned char *edge[2];
+  int size;         // vertices each buffer has room for
+  long allocations; // number of times the buffers were grown
+} ClipScratch;
+
+// Set cv to the volume seen by an image of rows by cols pixels: the four image
+// sides, plus the near plane h = CLIP_NEAR_H if VTM is projective. An affine
+// VTM, such as a 2D view, is clipped against the sides only. The back plane is
+// left out: lines are drawn without a depth test, so geometry past it has
+// always been visible, and scenes such as the one in test6b.c rely on that.
+void clip_volume(ClipVolume *cv, const Matrix *VTM, int rows, int cols);
+
+// Add the back plane z = 1 of a matrix_setView3D view to cv, for callers that
+// want geometry past view->b removed as well.
+void clip_addBack(ClipVolume *cv);
+
+// Set cv to the screen-space rectangle xmin <= x <= xmax, ymin <= y <= ymax,
+// for points that have already been divided by h.
+void clip_rect(ClipVolume *cv, double xmin, double ymin, double xmax,
+               double ymax);
+
+// Return a code with bit i set if p is outside plane i of cv.
+int clip_outcode(const ClipVolume *cv, const Point *p);
+
+// Clip the segment from a to b against cv with the Liang-Barsky parametric
+// test. Returns 0 if none of it is inside; otherwise moves a and b to the ends
+// of the inside part and returns 1. An endpoint that is already inside is
+// left exactly as it was.
+int clip_line(const ClipVolume *cv, Point *a, Point *b);
+
+// Clip the polygon with the n vertices in against each plane of cv in turn,
+// Sutherland-Hodgman style. Returns the number of vertices left and points
+// *out at them, in cs. (*edge)[i] is non-zero if the edge from vertex i to
+// vertex i + 1 (the last wraps to the first) is part of an edge of the input
+// polygon, and zero if clipping made it, so an outline can leave it out.
+int clip_polygon(const ClipVolume *cv, const Point *in, int n, ClipScratch *cs,
+                 Point **out, unsigned char **edge);
+
+// Free the buffers of cs and reset it to all zeros.
+void clipscratch_free(ClipScratch *cs);
+
+#endif // CLIP_H
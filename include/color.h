@@ -28,4 +28,10 @@ void image_setColor(Image *src, int r, int c, Color val);
 */
 Color image_getColor(Image *src, int r, int c);
 
+/**
+* @brief Returns val as src stores it: what image_getColor reads back after
+* image_setColor(src, r, c, val). Only an RGBA8 image changes it.
+*/
+Color image_roundColor(Image *src, Color val);
+
 #endif // COLOR_IMAGE_H
@@ -0,0 +1,60 @@
+#ifndef COMPILED_MODULE_H
+#define COMPILED_MODULE_H
+
+#include "hierarchical_modeling.h"
+
+// Extra record types used only in a compiled command buffer. They continue the
+// ObjectType numbering; ObjModule records mark the start of a submodule.
+// ObjInstances elements are expanded into one submodule per instance.
+#define CmdModuleEnd (ObjInstances + 1)
+
+// Header of one record in a compiled command buffer. The payload is stored
+// inline right after the header: a Point, a Line, a Matrix, a Color, a float,
+// or a run of count Points for polylines and polygons.
+typedef struct {
+  int type;  // ObjectType of the record, or CmdModuleEnd
+  int size;  // size of the whole record in bytes, header included
+  int count; // number of vertices for polylines and polygons
+  int flag;  // zBuffer for polylines; oneSided | zBuffer << 1 for polygons
+} CompiledRecord;
+
+// Saved traversal state for one level of submodule nesting.
+typedef struct {
+  Matrix LTM;
+  Matrix VGTM; // VTM * GTM of the enclosing module
+  Matrix CTM;  // VGTM * LTM
+  DrawState ds;
+} CompiledFrame;
+
+// A Module hierarchy flattened into one contiguous buffer of tagged records.
+// Submodules are inlined between ObjModule and CmdModuleEnd records and runs
+// of consecutive ObjMatrix elements are folded into a single matrix.
+typedef struct CompiledModule {
+  unsigned char *data;   // the records, back to back
+  size_t size;           // bytes of data in use
+  size_t capacity;       // bytes of data allocated
+  int nRecords;          // number of records in data
+  int maxDepth;          // deepest submodule nesting
+  int maxVertex;         // largest vertex run in any record
+  CompiledFrame *stack;  // maxDepth frames used by compiled_module_draw
+} CompiledModule;
+
+// Flatten md and everything it references into a new CompiledModule. Later
+// changes to md are not seen by the compiled copy.
+CompiledModule *module_compile(Module *md);
+
+// Draw the compiled module exactly as module_draw would draw the Module it was
+// compiled from, walking the record buffer front to back.
+void compiled_module_draw(CompiledModule *cm, Matrix *VTM, Matrix *GTM,
+                          DrawState *ds, Lighting *lighting, Image *src);
+
+// Draw the compiled module like compiled_module_draw, starting from the
+// composite VGTM = VTM * GTM instead of the two matrices and clipping to clip.
+void compiled_module_drawComposite(CompiledModule *cm, Matrix *VGTM,
+                                   const ClipVolume *clip, DrawState *ds,
+                                   Lighting *lighting, Image *src);
+
+// Free all of the memory associated with a compiled module.
+void compiled_module_free(CompiledModule *cm);
+
+#endif // COMPILED_MODULE_H
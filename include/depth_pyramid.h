@@ -0,0 +1,62 @@
+#ifndef DEPTH_PYRAMID_H
+#define DEPTH_PYRAMID_H
+
+#include "image.h"
+
+// Level 0 tiles are (1 << DEPTH_PYRAMID_SHIFT) pixels on a side; every level
+// above halves the number of tiles each way, up to a single tile.
+#define DEPTH_PYRAMID_SHIFT 3
+#define DEPTH_PYRAMID_MAX_LEVELS 24
+
+// Hierarchical view of an image's depth buffer for occlusion tests. far holds,
+// for every tile of every level, a value no larger than the 1/z of any pixel
+// under the tile, so the tile is known to be covered by surfaces at least that
+// close. The bound is kept exact lazily: a depth-tested write can only raise a
+// pixel's 1/z, which leaves the bound valid, so the rasterizers just mark the
+// level 0 tile dirty and the next occlusion test that reaches it rescans its
+// pixels. Writes that may lower 1/z lower the bound on every level at once.
+//
+// An image only keeps its pyramid up to date while src->hiz points at it.
+typedef struct DepthPyramid {
+  int rows, cols; // size of the image the pyramid covers
+  int nLevels;
+  int tileRows[DEPTH_PYRAMID_MAX_LEVELS];
+  int tileCols[DEPTH_PYRAMID_MAX_LEVELS];
+  float *far[DEPTH_PYRAMID_MAX_LEVELS]; // per-tile lower bound on 1/z
+  unsigned char *dirty; // level 0 tiles written since their bound was set
+  float *storage;       // every level of far, back to back
+  int size;             // floats storage has room for
+  int dirtySize;        // bytes dirty has room for
+  long allocations;     // number of times the buffers were grown
+} DepthPyramid;
+
+// Size dp for src and forget everything it knew: every bound is set to -FLT_MAX
+// and every tile is dirty, so the first tests rescan the depth buffer as it is.
+// Start dp from all zeros; its buffers only grow.
+void depthpyramid_reset(DepthPyramid *dp, Image *src);
+
+// Record a depth-tested write to pixel (row, col), which did not lower its 1/z.
+void depthpyramid_touch(DepthPyramid *dp, int row, int col);
+
+// Record depth-tested writes to columns c0 to c1 of row.
+void depthpyramid_touchSpan(DepthPyramid *dp, int row, int c0, int c1);
+
+// Record that pixel (row, col) now holds a 1/z of z, which may be lower than
+// before.
+void depthpyramid_lower(DepthPyramid *dp, int row, int col, float z);
+
+// Return non-zero if every pixel of src in rows y0 to y1 and columns x0 to x1,
+// all inside the image, holds a 1/z greater than nearest, so a surface no
+// closer than 1/z = nearest would fail the depth test everywhere in the
+// rectangle.
+int depthpyramid_hidden(DepthPyramid *dp, Image *src, int x0, int y0, int x1,
+                        int y1, float nearest);
+
+// Record that columns c0 to c1 of row were all set to a 1/z of z, which may
+// be higher or lower than before.
+void depthpyramid_fillSpan(DepthPyramid *dp, int row, int c0, int c1, float z);
+
+// Free the buffers of dp and reset it to all zeros.
+void depthpyramid_free(DepthPyramid *dp);
+
+#endif // DEPTH_PYRAMID_H
@@ -0,0 +1,40 @@
+#ifndef GEOMETRY_FLOAT_H
+#define GEOMETRY_FLOAT_H
+
+#include "transform.h"
+
+// Single-precision counterparts of Point and Matrix. They let a caller run
+// the transform stages in float whatever Coord the library was built with,
+// e.g. to measure what a GEOMETRY_FLOAT build would do to a scene.
+typedef struct {
+  float val[4];
+} PointF;
+
+typedef struct {
+  float m[4][4];
+} MatrixF;
+
+// Convert between the double and float types, rounding to nearest.
+void pointf_fromPoint(PointF *to, const Point *from);
+void point_fromPointF(Point *to, const PointF *from);
+void matrixf_fromMatrix(MatrixF *to, const Matrix *from);
+
+// Normalize p by its homogeneous coordinate, like point_normalize.
+void pointf_normalize(PointF *p);
+
+// Multiply left and right and put the result in m, which may be either input.
+void matrixf_multiply(const MatrixF *left, const MatrixF *right, MatrixF *m);
+
+// Transform the point p by the matrix m and put the result in q. p and q may
+// be the same.
+void matrixf_xformPoint(const MatrixF *m, const PointF *p, PointF *q);
+
+// Transform the n points in by the matrix m and put the results in out,
+// normalizing each one like pointf_normalize if divide is non-zero. An SSE
+// build keeps the four columns of m in registers for the whole run; like
+// matrix_xformPoints, in and out may be the same array but must not otherwise
+// overlap.
+void matrixf_xformPoints(const MatrixF *m, const PointF *in, PointF *out,
+                         int n, int divide);
+
+#endif // GEOMETRY_FLOAT_H
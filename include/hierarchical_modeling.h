@@ -1,7 +1,9 @@
 #ifndef HIERARCHICAL_MODELING_H
 #define HIERARCHICAL_MODELING_H
 
+#include "clip.h"
 #include "graphics.h"
+#include "scene_arena.h"
 #include "transform.h"
 
 // Object types Enum
@@ -18,7 +20,8 @@ typedef enum {
   ObjSurfaceColor,
   ObjSurfaceCoeff,
   //   ObjLight,
-  ObjModule
+  ObjModule,
+  ObjInstances
 } ObjectType;
 
 // Element structure
@@ -28,12 +31,41 @@ typedef struct Element {
   struct Element *next;
 } Element;
 
+// Axis-aligned box in a module's local coordinates
+typedef struct {
+  double min[3];
+  double max[3];
+  int empty; // non-zero if the box contains nothing
+  int depthTested; // non-zero if every primitive inside has its z-buffer
+                   // flag set; points never do
+} Bounds;
+
 // Module structure
 typedef struct {
   Element *head;
   Element *tail;
+  SceneArena *arena; // storage for elements and payloads, NULL uses malloc
+  Matrix boundsLTM;  // LTM in effect after the last element of the list
+  Bounds geometry;   // bounds of the module's own primitives
+  Bounds bounds;     // geometry plus every referenced submodule
+  int nSubmodules;   // number of ObjModule elements in the list
+  unsigned long boundsEpoch; // value of the module epoch when bounds was valid
+  unsigned long changeEpoch; // module epoch of the last change to the module
+                             // or a submodule, as of boundsEpoch
 } Module;
 
+struct CompiledModule;
+
+// One prototype module drawn once for every matrix in a packed array. Instance
+// i is drawn like a submodule preceded by the matrix xforms[i].
+typedef struct {
+  Module *proto;
+  Matrix *xforms; // n instance matrices, stored back to back
+  int n;
+  struct CompiledModule *compiled; // proto flattened for drawing, or NULL
+  unsigned long compiledEpoch;     // changeEpoch of proto compiled was built at
+} Instances;
+
 // ShadeMethod Enum
 typedef enum {
   ShadeFrame,
@@ -61,6 +93,18 @@ typedef struct {
   int nLights;
 } Lighting;
 
+// Counters collected by module_draw since the last drawstats_reset.
+typedef struct {
+  long allocations;   // heap allocations made while drawing
+  long culledModules; // submodule subtrees skipped as outside the view volume
+  long culledInstances; // instances skipped as outside the view volume
+  long composes;        // composite VTM * GTM * LTM matrices built
+  long vertexTransforms; // vertices taken through a composite matrix
+  long clippedPrimitives; // primitives cut or dropped by the clip volume
+  long occludedModules;   // submodule subtrees skipped as hidden in depth
+  long occludedInstances; // instances skipped as hidden in depth
+} DrawStats;
+
 // Function to create an initialized but empty Element
 Element *element_create();
 
@@ -75,6 +119,11 @@ void element_delete(Element *e);
 // Allocate an empty module.
 Module *module_create();
 
+// Allocate an empty module whose Elements and payloads all come out of arena.
+// The module and its contents are released together by scenearena_reset, so
+// module_clear and module_delete only unlink the Elements.
+Module *module_create_in(SceneArena *arena);
+
 // clear the module’s list of Elements, freeing memory as appropriate.
 void module_clear(Module *md);
 
@@ -85,9 +134,20 @@ void module_delete(Module *md);
 // Generic insert of an element into the module at the tail of the list.
 void module_insert(Module *md, Element *e);
 
+// Return the bounding box of everything md draws, in md's local coordinates.
+// Primitives grow the bounds as they are inserted. Submodules are added here,
+// in one walk over the modules that were changed since they were last checked.
+Bounds *module_bounds(Module *md);
+
 // Adds a pointer to the Module sub to the tail of the module’s list.
 void module_module(Module *md, Module *sub);
 
+// Adds n instances of the Module proto to the tail of the module’s list, one
+// for each matrix in xforms. The matrices are copied; proto is referenced like
+// a submodule. module_draw flattens proto once and replays it per instance,
+// skipping the instances whose bounds fall outside the image.
+void module_instances(Module *md, Module *proto, Matrix *xforms, int n);
+
 // Adds p to the tail of the module’s list.
 void module_point(Module *md, Point *p);
 void module_line(Module *md, Line *p);
@@ -113,10 +173,75 @@ void module_shear2D(Module *md, double shx, double shy);
 
 // Draw the module into the image using the given view transformation matrix
 // [VTM], Lighting and DrawState by traversing the list of Elements. (For now,
-// Lighting can be an empty structure.)
+// Lighting can be an empty structure.) Submodules are walked with an explicit
+// stack, so hierarchies may be nested arbitrarily deep. Primitives are
+// clipped to the volume VTM shows in src (see clip_volume), and a submodule
+// whose bounds lie entirely outside one of its planes is skipped along with
+// everything below it.
+//
+// With a perspective VTM and the DrawState's zBufferFlag set, the depth
+// buffer of src is summarized in a DepthPyramid while drawing. A submodule or
+// instance whose primitives are all depth-tested, and whose bounds project to
+// a screen rectangle that is already covered by closer surfaces than the
+// nearest corner of the bounds, is skipped as well.
 void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds,
                  Lighting *lighting, Image *src);
 
+// Receiver for the projected lines and points of a traversal. Polylines and
+// polygons arrive as the individual segments their draw functions would draw.
+// Coordinates are in pixels, already divided by the homogeneous coordinate.
+typedef struct DrawSink {
+  void (*line)(struct DrawSink *sink, Line *l, Color c);
+  void (*point)(struct DrawSink *sink, Point *p, Color c);
+} DrawSink;
+
+// Traverse the module exactly like module_draw, but hand every projected
+// primitive to sink instead of drawing it into src. src is still used for
+// culling submodules that fall outside the image; nothing is culled as hidden
+// in depth, since the depth buffer of src is not written.
+void module_drawSink(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds,
+                     Lighting *lighting, Image *src, DrawSink *sink);
+
+// Reset the module_draw statistics to zero.
+void drawstats_reset(void);
+
+// Copy the current module_draw statistics into stats. module_draw keeps one
+// scratch vertex buffer that grows to the largest primitive drawn, so after the
+// first frame allocations stays at zero.
+void drawstats_get(DrawStats *stats);
+
+// Multiply left by right into m like matrix_multiply and count it as a
+// compose in the DrawStats. The traversals build their composite matrices
+// with it.
+void draw_compose(Matrix *left, Matrix *right, Matrix *m);
+
+// Transform a primitive by the composite CTM = VTM * GTM * LTM, one matrix
+// per vertex, clip it against clip before the divide by h, and draw what is
+// left into src using the DrawState color. Points outside are dropped, lines
+// and polyline segments are cut with clip_line, and polygons with
+// clip_polygon, whose outline leaves out the edges clipping adds. These are
+// the per-primitive steps of module_draw, which only rebuilds CTM when LTM or
+// the module changes.
+void draw_composite_point(Point *p, Matrix *CTM, const ClipVolume *clip,
+                          DrawState *ds, Image *src);
+void draw_composite_line(Line *l, Matrix *CTM, const ClipVolume *clip,
+                         DrawState *ds, Image *src);
+void draw_composite_polyline(Polyline *p, Matrix *CTM, const ClipVolume *clip,
+                             DrawState *ds, Image *src);
+void draw_composite_polygon(Polygon *p, Matrix *CTM, const ClipVolume *clip,
+                            DrawState *ds, Image *src);
+
+// Compose VTM * GTM * LTM and draw a primitive through it, clipped to the
+// volume VTM shows in src, like the draw_composite functions.
+void draw_transformed_point(Point *p, Matrix *VTM, Matrix *GTM, Matrix *LTM,
+                            DrawState *ds, Image *src);
+void draw_transformed_line(Line *l, Matrix *VTM, Matrix *GTM, Matrix *LTM,
+                           DrawState *ds, Image *src);
+void draw_transformed_polyline(Polyline *p, Matrix *VTM, Matrix *GTM,
+                               Matrix *LTM, DrawState *ds, Image *src);
+void draw_transformed_polygon(Polygon *p, Matrix *VTM, Matrix *GTM,
+                              Matrix *LTM, DrawState *ds, Image *src);
+
 // Matrix operand to add a 3D translation to the Module
 void module_translate(Module *md, double tx, double ty, double tz);
 
@@ -152,6 +277,9 @@ void module_surfaceCoeff(Module *md, float coeff);
 // create a new DrawState structure and initialize the fields.
 DrawState *drawstate_create();
 
+// set the fields of an existing DrawState to the ones drawstate_create gives.
+void drawstate_init(DrawState *ds);
+
 // set the color field to c.
 void drawstate_setColor(DrawState *ds, Color c);
 
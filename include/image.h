@@ -1,6 +1,9 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include <stddef.h>
+#include <string.h>
+
 /**
  * @file image.h
  * @brief Header file for image manipulation functions and structures.
@@ -12,6 +15,12 @@
 
 /**
  * @brief Structure representing a pixel with RGB, alpha, and depth values.
+ *
+ * z is the depth buffer. It holds 1/z of the nearest surface drawn with the
+ * depth test on, where z is the depth in the canonical view volume that
+ * matrix_setView3D leaves in a point, so larger values are closer. 1/z, unlike
+ * z, varies linearly across the screen, so the rasterizers interpolate it
+ * directly.
  */
 typedef struct {
   float rgb[3];
@@ -19,17 +28,101 @@ typedef struct {
   float z;
 } FPixel;
 
+/**
+ * @brief Depth buffer value of a pixel nothing depth-tested has been drawn to:
+ * 1/z of a surface infinitely far away, so anything in front of the eye
+ * passes. (Geometry past the back plane of the view is not clipped, so the
+ * back plane itself, 1/z = 1, would hide it.)
+ */
+#define IMAGE_Z_CLEAR 0.0f
+
+/**
+ * @brief Depth test counters, kept by the rasterizers since the last
+ * depthstats_reset.
+ */
+typedef struct {
+  long tested;   // pixels that were depth-tested
+  long rejected; // pixels that failed the test and were not drawn
+} DepthStats;
+
+/**
+ * @brief Alignment in bytes of an image's pixel block and of the start of
+ * every row in it.
+ */
+#define IMAGE_ALIGN 64
+
+/**
+ * @brief Tiles of the lazy clear are (1 << IMAGE_TILE_SHIFT) pixels on a
+ * side.
+ */
+#define IMAGE_TILE_SHIFT 5
+
+/**
+ * @brief How an image stores its pixels.
+ *
+ * ImageInterleaved keeps whole FPixels one after another. ImagePlanar keeps
+ * each channel in a plane of its own, so fills, clears, depth tests and output
+ * conversion read and write only the channels they need, as straight runs of
+ * floats. ImageRGBA8 keeps four bytes per pixel, the 8-bit values image_write
+ * would have converted the channels to, and an optional depth plane of 16- or
+ * 24-bit codes, so drawing touches 4 to 8 bytes a pixel instead of 20 and
+ * image_write copies the bytes out as they are.
+ */
+typedef enum { ImageInterleaved, ImagePlanar, ImageRGBA8 } ImageLayout;
+
 /**
  * @brief Structure representing an image with various properties.
+ *
+ * An interleaved image keeps its pixels in one IMAGE_ALIGN-aligned block:
+ * pixel (r, c) is pixels[r * stride + c]. stride is cols rounded up so that
+ * every row starts on an IMAGE_ALIGN boundary; the padding pixels at the end
+ * of a row are never drawn to. data holds a pointer to the start of each row,
+ * so data[r][c] is the same storage. Because of the lazy clear described
+ * below, that storage only holds the pixel once its tile has been prepared:
+ * call image_prepare or image_prepareSpan before reading or writing through
+ * data or pixels.
+ *
+ * A planar image instead has five planes of rows * stride floats in one
+ * aligned block, rgb[0], rgb[1], rgb[2], alpha and depth in that order, with
+ * stride counted in floats, and the channels of pixel (r, c) at index
+ * r * stride + c of each. It has no FPixels, so data and pixels are NULL;
+ * the access functions below work with any layout.
+ *
+ * An RGBA8 image has rows * stride pixels of red, green, blue and alpha bytes
+ * in rgba, followed in the same block by a plane of depth codes, depth16 or
+ * depth24, if depthBits is 16 or 24. A channel value v is stored as
+ * image_byte(v), and 1/z as image_depthCode(z, depthBits); reading them
+ * back gives the byte / 255 and image_depthValue of the code.
+ *
+ * Clearing is lazy in every layout. The image is cut into square tiles, and
+ * image_alloc, image_reset and image_fill only record the clear value and
+ * flag every tile as cleared. A cleared tile's storage is not touched: the
+ * access functions and image_write read its pixels as clearValue, and the
+ * first write to it stores clearValue in all its pixels first. Code that
+ * writes to the storage directly calls image_prepare or image_prepareSpan
+ * before it, and code that reads it directly checks image_cleared.
  */
 typedef struct {
-  FPixel **data; // Pointer to the space for storing pixels
+  FPixel **data;  // row pointers into pixels; NULL if planar
+  FPixel *pixels; // rows * stride pixels, row after row; NULL if planar
+  float *rgb[3];  // color planes of a planar image; rgb[0] owns the block
+  int stride;     // pixels (floats if planar) from one row to the next
+  ImageLayout layout;
   int rows;
   int cols;
-  float *depth;
-  float *alpha;
+  float *depth; // 1/z plane of a planar image
+  float *alpha; // alpha plane of a planar image
+  unsigned char *rgba;     // pixels of an RGBA8 image; owns the block
+  unsigned short *depth16; // depth codes of an RGBA8 image, if depthBits is 16
+  unsigned int *depth24;   // depth codes of an RGBA8 image, if depthBits is 24
+  int depthBits;           // bits of depth an RGBA8 image keeps: 0, 16 or 24
+  unsigned char *cleared;  // per tile, row by row: non-zero while cleared
+  int tileRows, tileCols;  // tiles down and across
+  FPixel clearValue;       // what the pixels of a cleared tile read as
   float maxval;
   char *filename;
+  struct DepthPyramid *hiz; // depth pyramid the rasterizers keep up to date
+                            // while it is set, see depth_pyramid.h
 } Image;
 
 // Constructors and destructors
@@ -59,7 +152,7 @@ void image_free(Image *src);
 void image_init(Image *src);
 
 /**
- * @brief Allocates space for the image data.
+ * @brief Allocates space for the image data, in the layout src already has.
  *
  * @param src Pointer to the Image structure.
  * @param rows Number of rows in the image.
@@ -70,11 +163,125 @@ int image_alloc(Image *src, int rows, int cols);
 
 /**
  * @brief Deallocates the image data and resets the Image structure fields.
+ * The layout is kept.
  *
  * @param src Pointer to the Image structure.
  */
 void image_dealloc(Image *src);
 
+/**
+ * @brief Switches the image to the given storage layout. An image that
+ * already has pixels is reallocated at the same size and reset, so what was
+ * drawn on it is lost. image_create makes interleaved images; to make a
+ * planar one without allocating twice, switch an image created at 0 by 0 and
+ * then call image_alloc.
+ *
+ * @param src Pointer to the Image structure.
+ * @param layout ImageInterleaved, ImagePlanar or ImageRGBA8.
+ * @return 0 if successful, non-zero otherwise.
+ */
+int image_setLayout(Image *src, ImageLayout layout);
+
+/**
+ * @brief Sets the bits of depth an RGBA8 image keeps: 24 (the default), 16,
+ * or 0 for none, in which case nothing drawn on it is depth-tested. An RGBA8
+ * image that already has pixels is reallocated and reset as by
+ * image_setLayout.
+ *
+ * @param src Pointer to the Image structure.
+ * @param bits 0, 16 or 24.
+ * @return 0 if successful, non-zero otherwise.
+ */
+int image_setDepthBits(Image *src, int bits);
+
+/**
+ * @brief Returns non-zero if the image keeps a depth buffer, which every
+ * layout but RGBA8 with depthBits 0 does.
+ */
+int image_hasDepth(Image *src);
+
+// Lazy clear and RGBA8 helpers, inline because the rasterizers use them for
+// every pixel
+
+/**
+ * @brief Returns non-zero if pixel (r, c) is in a tile that is still cleared,
+ * so its storage does not hold its value.
+ */
+static inline int image_cleared(const Image *src, int r, int c) {
+  return src->cleared[(r >> IMAGE_TILE_SHIFT) * src->tileCols +
+                      (c >> IMAGE_TILE_SHIFT)];
+}
+
+/**
+ * @brief Stores the clear value in every pixel of the tile holding pixel
+ * (r, c), if it is still cleared, and flags it as written.
+ */
+void image_materialize(Image *src, int r, int c);
+
+/**
+ * @brief Makes the storage of pixel (r, c) hold its value, ready to be read
+ * or written directly.
+ */
+static inline void image_prepare(Image *src, int r, int c) {
+  if (image_cleared(src, r, c))
+    image_materialize(src, r, c);
+}
+
+/**
+ * @brief image_prepare for columns c0 to c1, inclusive, of row.
+ */
+void image_prepareSpan(Image *src, int row, int c0, int c1);
+
+/**
+ * @brief The byte a channel value v is stored as: v * 255 truncated, the
+ * conversion image_write has always made.
+ */
+static inline unsigned char image_byte(float v) {
+  return (unsigned char)(v * 255);
+}
+
+/**
+ * @brief The depth code of 1/z = z: the top bits of its float bit pattern.
+ * For the non-negative values a depth buffer holds the codes order the way
+ * the values do and keep the same relative precision at any distance; 16 bits
+ * keep 7 bits of mantissa and 24 bits keep 15. Values below zero code as 0.
+ */
+static inline unsigned int image_depthCode(float z, int bits) {
+  unsigned int u;
+  if (!(z > 0.0f))
+    return 0;
+  memcpy(&u, &z, sizeof(u));
+  return u >> (32 - bits);
+}
+
+/**
+ * @brief The 1/z a depth code reads back as, which is never above any value
+ * that codes to it.
+ */
+static inline float image_depthValue(unsigned int code, int bits) {
+  unsigned int u = code << (32 - bits);
+  float z;
+  memcpy(&z, &u, sizeof(z));
+  return z;
+}
+
+/**
+ * @brief The depth code of pixel i of an RGBA8 image with depth.
+ */
+static inline unsigned int image_depthGet(const Image *src, size_t i) {
+  return src->depthBits == 16 ? src->depth16[i] : src->depth24[i];
+}
+
+/**
+ * @brief Sets the depth code of pixel i of an RGBA8 image with depth.
+ */
+static inline void image_depthSet(Image *src, size_t i, unsigned int code) {
+  if (src->depthBits == 16)
+    src->depth16[i] = (unsigned short)code;
+  else
+    src->depth24[i] = code;
+}
+
 // I/O functions
 
 /**
@@ -182,14 +389,16 @@ void image_setz(Image *src, int r, int c, float val);
 
 /**
  * @brief Resets every pixel to a default value (black with full alpha and
- * depth).
+ * depth IMAGE_Z_CLEAR). Like image_fill, this only flags the tiles.
  *
  * @param src Pointer to the Image structure.
  */
 void image_reset(Image *src);
 
 /**
- * @brief Sets every pixel to the given FPixel value.
+ * @brief Sets every pixel to the given FPixel value. The pixels are not
+ * written: every tile is flagged as cleared to val, in time proportional to
+ * the number of tiles.
  * 
  * @param src Pointer to the Image structure.
  * @param val FPixel value to be set for every pixel.
@@ -197,7 +406,8 @@ void image_reset(Image *src);
 void image_fill(Image *src, FPixel val);
 
 /**
- * @brief Sets the RGB values of each pixel to the given color.
+ * @brief Sets the RGB values of each pixel to the given color. Cleared tiles
+ * only have the color of their clear value changed; the others are written.
  * 
  * @param src Pointer to the Image structure.
  * @param r Red value to be set.
@@ -207,7 +417,8 @@ void image_fill(Image *src, FPixel val);
 void image_fillrgb(Image *src, float r, float g, float b);
 
 /**
- * @brief Sets the alpha value of each pixel to the given value.
+ * @brief Sets the alpha value of each pixel to the given value, as
+ * image_fillrgb does the color.
  * 
  * @param src Pointer to the Image structure.
  * @param a Alpha value to be set.
@@ -215,11 +426,41 @@ void image_fillrgb(Image *src, float r, float g, float b);
 void image_filla(Image *src, float a);
 
 /**
- * @brief Sets the depth value of each pixel to the given value.
+ * @brief Sets the depth value of each pixel to the given value, as
+ * image_fillrgb does the color.
  * 
  * @param src Pointer to the Image structure.
  * @param z Depth value to be set.
  */
 void image_fillz(Image *src, float z);
 
+/**
+ * @brief Sets the pixels of row from column c0 to column c1, inclusive, to
+ * val. The span is clipped to the image once and then written with vector
+ * stores where the compiler targets AVX or SSE2.
+ *
+ * @param src Pointer to the Image structure.
+ * @param row Row index of the span.
+ * @param c0 First column of the span.
+ * @param c1 Last column of the span.
+ * @param val FPixel value to be set.
+ */
+void image_fillSpan(Image *src, int row, int c0, int c1, FPixel val);
+
+/**
+ * @brief Adds to the depth test counters. Called by the rasterizers once per
+ * primitive; safe to call from several threads.
+ */
+void depthstats_add(long tested, long rejected);
+
+/**
+ * @brief Resets the depth test counters to zero.
+ */
+void depthstats_reset(void);
+
+/**
+ * @brief Copies the depth test counters into stats.
+ */
+void depthstats_get(DepthStats *stats);
+
 #endif
\ No newline at end of file
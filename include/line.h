@@ -41,7 +41,20 @@ void line_copy(Line *to, Line *from);
 
 /**
  * @brief Draw the line into src using color c and the z-buffer, if appropriate.
+ * The line is clipped to the image with Cohen-Sutherland before it is
+ * stepped, so its cost depends only on the pixels it covers. If zBuffer is set
+ * and both ends have z > 0, 1/z is interpolated along the line and each pixel
+ * is drawn only if it is not behind the depth already in src; see FPixel.
+ * Other lines are drawn without a test and reset the depth they cover.
  */
 void line_draw(Line *l, Image *src, Color c);
 
+/**
+ * @brief Draw the line into src like line_draw, but only write the pixels in
+ * rows [r0, r1) and columns [c0, c1). Every pixel gets the value line_draw
+ * would give it, so a line can be drawn one tile at a time.
+ */
+void line_drawRect(Line *l, Image *src, Color c, int r0, int c0, int r1,
+                   int c1);
+
 #endif // LINE_H
@@ -0,0 +1,23 @@
+#ifndef MODULE_PARALLEL_H
+#define MODULE_PARALLEL_H
+
+#include "hierarchical_modeling.h"
+
+// Width and height in pixels of the screen tiles drawn by one thread at a time.
+#define PARALLEL_TILE_SIZE 64
+
+// Most threads module_draw_parallel will use, the calling thread included.
+#define PARALLEL_MAX_THREADS 64
+
+// Draw the module into src like module_draw, using up to nthreads threads.
+// The hierarchy is traversed once on the calling thread, which records every
+// projected line and point and bins it into the screen tiles its bounding box
+// touches. The tiles are then rasterized in parallel. Each tile replays its
+// commands in traversal order and only writes its own pixels, so the image is
+// identical to the one module_draw produces. Since nothing is drawn until the
+// traversal is done, submodules hidden behind others are not culled the way
+// module_draw culls them.
+void module_draw_parallel(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds,
+                          Lighting *lighting, Image *src, int nthreads);
+
+#endif // MODULE_PARALLEL_H
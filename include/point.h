@@ -5,11 +5,23 @@
 #include "image.h"
 #include <stdio.h>
 
+/**
+ * @brief Storage type of point coordinates. Building the library and the
+ * programs using it with -DGEOMETRY_FLOAT stores every Point, and with it the
+ * vertices of Lines, Polylines and Polygons, as float. Arithmetic on the
+ * coordinates is still done in double.
+ */
+#ifdef GEOMETRY_FLOAT
+typedef float Coord;
+#else
+typedef double Coord;
+#endif
+
 /**
  * @brief Structure representing a point in space.
  */
 typedef struct {
-  double val[4];
+  Coord val[4];
 } Point;
 
 /**
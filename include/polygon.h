@@ -7,6 +7,7 @@ typedef struct {
                  // (0) for shading
   int nVertex;   // number of vertices
   Point *vertex; // array of vertices
+  int zBuffer;   // whether to use the z-buffer, defaults to true (1)
 } Polygon;
 
 /// The functions polygon create and polygon free manage both the Polygon data
@@ -71,10 +72,10 @@ void polygon_setSided(Polygon *p, int oneSided);
 // void polygon_setAll(Polygon *p, int numV, Point *vlist, Color *clist,
 //                     Vector *nlist, int zBuffer, int oneSided);
 
-// /**
-//  * @brief sets the z-buffer flag to the given value.
-//  */
-// void polygon_zBuffer(Polygon *p, int flag);
+/**
+ * @brief sets the z-buffer flag to the given value.
+ */
+void polygon_zBuffer(Polygon *p, int flag);
 
 /**
  * @brief De-allocates/allocates space and copies the vertex and color data from
@@ -93,18 +94,28 @@ void polygon_print(Polygon *p, FILE *fp);
 void polygon_normalize(Polygon *p);
 
 /**
- * @brief draw the outline of the polygon using color c.
+ * @brief draw the outline of the polygon using color c. The edges are
+ * depth-tested like line_draw if the z-buffer flag is set.
  */
 void polygon_draw(Polygon *p, Image *src, Color c);
 
 /**
  * @brief draw the filled polygon using color c with the scanline z-buffer rendering algorithm.
+ * Polygons off the image are rejected, and polygons reaching past the guard
+ * band CLIP_GUARD_BAND are clipped to it before their edges are built. If the
+ * z-buffer flag is set and every vertex has z > 0, 1/z is interpolated along
+ * the edges and across each span and every pixel is depth-tested like
+ * line_draw.
  */
 void polygon_drawFill(Polygon *p, Image *src, Color c);
 void polygon_drawFill_GIF(Polygon *p, Image *src, Color c);
 
 /**
  * @brief draw the filled polygon using color c with the Barycentric coordinates algorithm.
+ * Only triangles are drawn. The pixels whose centers are inside are found with
+ * edge functions an 8x8 tile at a time: tiles outside an edge are skipped,
+ * tiles inside all three are filled without tests, and the rest are tested
+ * four pixels at a time.
  */
 void polygon_drawFillB(Polygon *p, Image *src, Color c);
 
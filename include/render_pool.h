@@ -0,0 +1,44 @@
+#ifndef RENDER_POOL_H
+#define RENDER_POOL_H
+
+#include "hierarchical_modeling.h"
+#include "image.h"
+
+// Recycled render targets for programs that draw a sequence of frames. A
+// frame loop takes an Image and a DrawState from the pool, draws and writes
+// the frame, and hands both back; the next frame gets the same buffers, so
+// after the first frame no image storage is allocated and its pages stay
+// mapped. Images and DrawStates taken from a pool go back to that pool, never
+// to image_free or free.
+typedef struct {
+  int rows, cols;       // size of every image handed out
+  Image **images;       // images handed back and ready to be reused
+  int nImages;          // number of them
+  int imageSize;        // entries images has room for
+  DrawState **states;   // DrawStates handed back and ready to be reused
+  int nStates;          // number of them
+  int stateSize;        // entries states has room for
+  long allocations;     // number of images and DrawStates created
+} RenderPool;
+
+// Allocate an empty pool for images of rows by cols pixels.
+RenderPool *renderpool_create(int rows, int cols);
+
+// Return an image of the pool's size, reset like a new one from
+// image_create. A recycled image keeps its layout and depth bits, and its
+// reset is lazy, so taking one costs O(tiles) rather than O(pixels).
+Image *renderpool_image(RenderPool *pool);
+
+// Hand src back to the pool once the frame is written.
+void renderpool_releaseImage(RenderPool *pool, Image *src);
+
+// Return a DrawState with the fields drawstate_create gives a new one.
+DrawState *renderpool_drawstate(RenderPool *pool);
+
+// Hand ds back to the pool.
+void renderpool_releaseDrawState(RenderPool *pool, DrawState *ds);
+
+// Free the pool and every image and DrawState handed back to it.
+void renderpool_free(RenderPool *pool);
+
+#endif // RENDER_POOL_H
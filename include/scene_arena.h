@@ -0,0 +1,40 @@
+#ifndef SCENE_ARENA_H
+#define SCENE_ARENA_H
+
+#include <stddef.h>
+
+// Default size of one arena block (1 MB).
+#define SCENE_ARENA_BLOCK_SIZE (1 << 20)
+
+// One contiguous chunk of arena memory. The usable bytes follow the header.
+typedef struct ArenaBlock {
+  struct ArenaBlock *next; // next (older) block in the chain
+  size_t size;             // number of usable bytes in the block
+  size_t used;             // number of bytes handed out so far
+} ArenaBlock;
+
+// Bump allocator that owns all Modules, Elements and payloads of a scene.
+// Individual allocations are never freed; the whole scene is released at once
+// with scenearena_reset or scenearena_free.
+typedef struct {
+  ArenaBlock *head;  // block currently being carved up
+  size_t blockSize;  // size of each new block
+  size_t bytesUsed;  // total bytes handed out since the last reset
+} SceneArena;
+
+// Allocate an empty arena whose blocks hold blockSize bytes. A blockSize of 0
+// selects SCENE_ARENA_BLOCK_SIZE.
+SceneArena *scenearena_create(size_t blockSize);
+
+// Return size bytes of arena memory aligned for any Point, Matrix or pointer.
+// Requests larger than the block size get a block of their own.
+void *scenearena_alloc(SceneArena *arena, size_t size);
+
+// Release everything allocated from the arena. One block is kept and rewound
+// so the next scene can be built without touching the system allocator.
+void scenearena_reset(SceneArena *arena);
+
+// Free all of the memory associated with the arena, including the arena.
+void scenearena_free(SceneArena *arena);
+
+#endif // SCENE_ARENA_H
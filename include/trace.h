@@ -0,0 +1,68 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Trace levels, selected at build time with -DTRACE_LEVEL=n. Every trace macro
+// above the selected level expands to nothing, so its arguments are not even
+// evaluated.
+#define TRACE_LEVEL_OFF 0       // no tracing
+#define TRACE_LEVEL_FRAME 1     // a few events per frame: views, module draws
+#define TRACE_LEVEL_PRIMITIVE 2 // plus one event for every primitive drawn
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_OFF
+#endif
+
+// Number of events kept in the ring buffer, a power of two. Once it is full
+// the oldest events are overwritten.
+#ifndef TRACE_BUFFER_SIZE
+#define TRACE_BUFFER_SIZE 16384
+#endif
+
+// Most numeric arguments one event can carry (enough for a Matrix).
+#define TRACE_MAX_ARGS 16
+
+// Record one event in the ring buffer. phase is a Chrome trace phase: 'B' and
+// 'E' open and close a span, 'i' marks an instant. argNames is a comma
+// separated list naming the nargs values in args, or NULL to number them.
+// name and argNames must be string literals or otherwise outlive the trace.
+// Safe to call from several threads at once; it never locks or does I/O.
+void trace_emit(const char *name, const char *argNames, char phase,
+                const double *args, int nargs);
+
+// Write the events in the ring buffer, oldest first, to filename in the Chrome
+// trace event JSON format (load it in chrome://tracing or Perfetto). Call it
+// while no thread is emitting. Returns the number of events written, or -1 if
+// the file cannot be opened.
+int trace_export(const char *filename);
+
+// Discard every event in the ring buffer.
+void trace_clear(void);
+
+#define TRACE_ARGS(...) ((const double[]){__VA_ARGS__})
+#define TRACE_NARGS(...) ((int)(sizeof(TRACE_ARGS(__VA_ARGS__)) / sizeof(double)))
+
+#if TRACE_LEVEL >= TRACE_LEVEL_FRAME
+#define TRACE_FRAME_BEGIN(name) trace_emit(name, NULL, 'B', NULL, 0)
+#define TRACE_FRAME_END(name) trace_emit(name, NULL, 'E', NULL, 0)
+#define TRACE_FRAME(name, argNames, ...)                                       \
+  trace_emit(name, argNames, 'i', TRACE_ARGS(__VA_ARGS__), TRACE_NARGS(__VA_ARGS__))
+#define TRACE_FRAME_MATRIX(name, mat)                                          \
+  trace_emit(name, NULL, 'i', &(mat)->m[0][0], 16)
+#else
+#define TRACE_FRAME_BEGIN(name) ((void)0)
+#define TRACE_FRAME_END(name) ((void)0)
+#define TRACE_FRAME(name, argNames, ...) ((void)0)
+#define TRACE_FRAME_MATRIX(name, mat) ((void)0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_PRIMITIVE
+#define TRACE_PRIMITIVE(name, argNames, ...)                                   \
+  trace_emit(name, argNames, 'i', TRACE_ARGS(__VA_ARGS__), TRACE_NARGS(__VA_ARGS__))
+#define TRACE_PRIMITIVE_MATRIX(name, mat)                                      \
+  trace_emit(name, NULL, 'i', &(mat)->m[0][0], 16)
+#else
+#define TRACE_PRIMITIVE(name, argNames, ...) ((void)0)
+#define TRACE_PRIMITIVE_MATRIX(name, mat) ((void)0)
+#endif
+
+#endif // TRACE_H
@@ -4,8 +4,25 @@
 #include "graphics.h"
 #include "point.h"
 
+// What a matrix is known to be, from most general to most special. Every
+// kind but MatrixProjective has a bottom row of 0 0 0 1. The kind only ever
+// claims less than the matrix is, never more, so MatrixProjective is always a
+// safe answer; it is also what a zero-initialized Matrix gets.
+typedef enum {
+  MatrixProjective, // any 4x4 matrix
+  MatrixAffine,     // any 3x4 matrix: rotation, scale, shear and translation
+  MatrixRigid,      // rotation and translation only
+  MatrixScale,      // diagonal, no translation
+  MatrixTranslate,  // identity 3x3 part plus a translation
+  MatrixIdentity
+} MatrixKind;
+
+// The matrix functions keep kind up to date, and matrix_multiply and the
+// transform functions use it to skip the work the zero and one entries make
+// redundant. Code that writes m directly must call matrix_classify afterwards.
 typedef struct {
   double m[4][4];
+  MatrixKind kind;
 } Matrix;
 
 typedef Point Vector;
@@ -50,9 +67,13 @@ void matrix_identity(Matrix *m);
 // Return the element of the matrix at row r, column c.
 double matrix_get(Matrix *m, int r, int c);
 
-// Set the element of the matrix at row r, column c to v.
+// Set the element of the matrix at row r, column c to v and update its kind.
 void matrix_set(Matrix *m, int r, int c, double v);
 
+// Set the kind of m from its entries and return it. Recognizes every kind but
+// MatrixRigid, which only the rotation functions assign.
+MatrixKind matrix_classify(Matrix *m);
+
 // Copy the src matrix into the dest matrix.
 void matrix_copy(Matrix *dest, Matrix *src);
 
@@ -61,6 +82,8 @@ void matrix_transpose(Matrix *m);
 
 // Multiply left and right and put the result in m. Make sure that the function
 // is written so that the result matrix can also be the left or right matrix.
+// The kind of the product follows from the kinds of the factors; products of
+// identity, translate, scale and affine matrices use reduced kernels.
 void matrix_multiply(Matrix *left, Matrix *right, Matrix *m);
 
 // Transform the point p by the matrix m and put the result in q. For this
@@ -71,6 +94,17 @@ void matrix_xformPoint(Matrix *m, Point *p, Point *q);
 // function, p and q need to be different variables.
 void matrix_xformVector(Matrix *m, Vector *p, Vector *q);
 
+// Transform the n points in by the matrix m and put the results in out. If
+// divide is non-zero each result is also normalized like point_normalize. The
+// matrix is set up once for the whole run; the SSE2 and AVX builds then use
+// the vector point kernel, the scalar build works on blocks laid out as
+// separate x, y, z and h arrays so the compiler can vectorize the inner loop.
+// Identity, translate and scale matrices get their own loops, and the scalar
+// build skips the h row of affine matrices. in and out may be the same array
+// but must not otherwise overlap.
+void matrix_xformPoints(const Matrix *m, const Point *in, Point *out, int n,
+                        int divide);
+
 // Transform the points and surface normals (if they exist) in the Polygon p by
 // the matrix m.
 void matrix_xformPolygon(Matrix *m, Polygon *p);
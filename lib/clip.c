@@ -0,0 +1,194 @@
+#include "../include/clip.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void clip_setPlane(ClipVolume *cv, double a, double b, double c,
+                          double d, double e) {
+  double *plane = cv->plane[cv->nPlanes++];
+  plane[0] = a;
+  plane[1] = b;
+  plane[2] = c;
+  plane[3] = d;
+  plane[4] = e;
+}
+
+void clip_volume(ClipVolume *cv, const Matrix *VTM, int rows, int cols) {
+  cv->nPlanes = 0;
+  clip_setPlane(cv, 1.0, 0.0, 0.0, 1.0, 0.0);   // x > -h
+  clip_setPlane(cv, -1.0, 0.0, 0.0, cols, 0.0); // x < cols * h
+  clip_setPlane(cv, 0.0, 1.0, 0.0, 1.0, 0.0);   // y > -h
+  clip_setPlane(cv, 0.0, -1.0, 0.0, rows, 0.0); // y < rows * h
+  if (VTM->kind == MatrixProjective) {
+    clip_setPlane(cv, 0.0, 0.0, 0.0, 1.0, -CLIP_NEAR_H); // in front of the eye
+  }
+}
+
+void clip_addBack(ClipVolume *cv) {
+  clip_setPlane(cv, 0.0, 0.0, -1.0, 0.0, 1.0); // z <= 1
+}
+
+void clip_rect(ClipVolume *cv, double xmin, double ymin, double xmax,
+               double ymax) {
+  cv->nPlanes = 0;
+  clip_setPlane(cv, 1.0, 0.0, 0.0, 0.0, -xmin);
+  clip_setPlane(cv, -1.0, 0.0, 0.0, 0.0, xmax);
+  clip_setPlane(cv, 0.0, 1.0, 0.0, 0.0, -ymin);
+  clip_setPlane(cv, 0.0, -1.0, 0.0, 0.0, ymax);
+}
+
+// Signed distance of p from plane, in units of the plane's coefficients.
+static inline double clip_distance(const double *plane, const Point *p) {
+  return plane[0] * p->val[0] + plane[1] * p->val[1] + plane[2] * p->val[2] +
+         plane[3] * p->val[3] + plane[4];
+}
+
+// out = a + t * (b - a). out may not be a or b.
+static inline void clip_lerp(const Point *a, const Point *b, double t,
+                             Point *out) {
+  for (int i = 0; i < 4; i++) {
+    out->val[i] = a->val[i] + t * (b->val[i] - a->val[i]);
+  }
+}
+
+int clip_outcode(const ClipVolume *cv, const Point *p) {
+  int code = 0;
+  for (int k = 0; k < cv->nPlanes; k++) {
+    if (clip_distance(cv->plane[k], p) < 0.0) {
+      code |= 1 << k;
+    }
+  }
+  return code;
+}
+
+int clip_line(const ClipVolume *cv, Point *a, Point *b) {
+  double t0 = 0.0, t1 = 1.0;
+
+  // each plane cuts off the start or the end of the parameter range
+  for (int k = 0; k < cv->nPlanes; k++) {
+    double da = clip_distance(cv->plane[k], a);
+    double db = clip_distance(cv->plane[k], b);
+    if (da < 0.0 && db < 0.0) {
+      return 0;
+    }
+    if (da < 0.0) {
+      double t = da / (da - db);
+      if (t > t0) {
+        t0 = t;
+      }
+    } else if (db < 0.0) {
+      double t = da / (da - db);
+      if (t < t1) {
+        t1 = t;
+      }
+    }
+  }
+  if (t0 > t1) {
+    return 0;
+  }
+
+  Point a0 = *a, b0 = *b;
+  if (t0 > 0.0) {
+    clip_lerp(&a0, &b0, t0, a);
+  }
+  if (t1 < 1.0) {
+    clip_lerp(&a0, &b0, t1, b);
+  }
+  return 1;
+}
+
+// Make sure both buffers of cs hold at least n vertices, keeping their
+// contents.
+static void clipscratch_reserve(ClipScratch *cs, int n) {
+  if (n <= cs->size) {
+    return;
+  }
+  int size = cs->size > 0 ? cs->size : 16;
+  while (size < n) {
+    size *= 2;
+  }
+  for (int i = 0; i < 2; i++) {
+    Point *vertex = (Point *)realloc(cs->vertex[i], sizeof(Point) * size);
+    unsigned char *edge = (unsigned char *)realloc(cs->edge[i], size);
+    if (vertex == NULL || edge == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(EXIT_FAILURE);
+    }
+    cs->vertex[i] = vertex;
+    cs->edge[i] = edge;
+  }
+  cs->size = size;
+  cs->allocations++;
+}
+
+int clip_polygon(const ClipVolume *cv, const Point *in, int n, ClipScratch *cs,
+                 Point **out, unsigned char **edge) {
+  int cur = 0;
+  int count = n > 0 ? n : 0;
+
+  clipscratch_reserve(cs, count);
+  if (count > 0) {
+    memcpy(cs->vertex[cur], in, sizeof(Point) * count);
+    memset(cs->edge[cur], 1, count);
+  }
+
+  for (int k = 0; k < cv->nPlanes && count > 0; k++) {
+    const double *plane = cv->plane[k];
+    Point *src = cs->vertex[cur];
+    int cut = 0;
+    for (int i = 0; i < count && !cut; i++) {
+      cut = clip_distance(plane, &src[i]) < 0.0;
+    }
+    if (!cut) {
+      continue;
+    }
+
+    // every vertex and every crossing adds at most one vertex
+    clipscratch_reserve(cs, 2 * count);
+    src = cs->vertex[cur];
+    unsigned char *srcEdge = cs->edge[cur];
+    Point *dst = cs->vertex[1 - cur];
+    unsigned char *dstEdge = cs->edge[1 - cur];
+    int m = 0;
+
+    // walk the edges s -> p, starting with the closing edge
+    const Point *s = &src[count - 1];
+    double ds = clip_distance(plane, s);
+    unsigned char es = srcEdge[count - 1];
+    for (int i = 0; i < count; i++) {
+      const Point *p = &src[i];
+      double dp = clip_distance(plane, p);
+      if (dp >= 0.0) {
+        if (ds < 0.0) {
+          // entering: the edge on from the crossing is part of s -> p
+          clip_lerp(s, p, ds / (ds - dp), &dst[m]);
+          dstEdge[m++] = es;
+        }
+        dst[m] = *p;
+        dstEdge[m++] = srcEdge[i];
+      } else if (ds >= 0.0) {
+        // leaving: the edge on from the crossing runs along the plane
+        clip_lerp(s, p, ds / (ds - dp), &dst[m]);
+        dstEdge[m++] = 0;
+      }
+      s = p;
+      ds = dp;
+      es = srcEdge[i];
+    }
+
+    cur = 1 - cur;
+    count = m;
+  }
+
+  *out = cs->vertex[cur];
+  *edge = cs->edge[cur];
+  return count;
+}
+
+void clipscratch_free(ClipScratch *cs) {
+  for (int i = 0; i < 2; i++) {
+    free(cs->vertex[i]);
+    free(cs->edge[i]);
+  }
+  memset(cs, 0, sizeof(ClipScratch));
+}
@@ -20,18 +20,27 @@ void color_set(Color *to, float r, float g, float b) {
 
 void image_setColor(Image *src, int r, int c, Color val) {
     if (src != NULL && r >= 0 && r < src->rows && c >= 0 && c < src->cols) {
-        src->data[r][c].rgb[0] = val.c[0];
-        src->data[r][c].rgb[1] = val.c[1];
-        src->data[r][c].rgb[2] = val.c[2];
+        image_setc(src, r, c, 0, val.c[0]);
+        image_setc(src, r, c, 1, val.c[1]);
+        image_setc(src, r, c, 2, val.c[2]);
     }
 }
 
+Color image_roundColor(Image *src, Color val) {
+    if (src != NULL && src->layout == ImageRGBA8) {
+        for (int i = 0; i < 3; i++) {
+            val.c[i] = image_byte(val.c[i]) / 255.0f;
+        }
+    }
+    return val;
+}
+
 Color image_getColor(Image *src, int r, int c) {
     Color color = {{0.0, 0.0, 0.0}};
     if (src != NULL && r >= 0 && r < src->rows && c >= 0 && c < src->cols) {
-        color.c[0] = src->data[r][c].rgb[0];
-        color.c[1] = src->data[r][c].rgb[1];
-        color.c[2] = src->data[r][c].rgb[2];
+        color.c[0] = image_getc(src, r, c, 0);
+        color.c[1] = image_getc(src, r, c, 1);
+        color.c[2] = image_getc(src, r, c, 2);
     }
     return color;
 }
\ No newline at end of file
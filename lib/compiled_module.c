@@ -0,0 +1,356 @@
+#include "../include/compiled_module.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Records are padded to 16 bytes so every inline Point and Matrix is aligned.
+#define RECORD_ALIGN 16
+#define RECORD_ROUND(n) (((n) + (RECORD_ALIGN - 1)) & ~(size_t)(RECORD_ALIGN - 1))
+#define RECORD_PAYLOAD(rec) ((void *)((CompiledRecord *)(rec) + 1))
+
+// Append a record with room for payload bytes and return its offset in the
+// buffer. Offsets stay valid when the buffer is reallocated, pointers do not.
+static size_t compiled_append(CompiledModule *cm, int type, size_t payload) {
+  size_t size = RECORD_ROUND(sizeof(CompiledRecord) + payload);
+
+  if (cm->size + size > cm->capacity) {
+    size_t capacity = cm->capacity > 0 ? cm->capacity : 4096;
+    while (cm->size + size > capacity) {
+      capacity *= 2;
+    }
+    unsigned char *data = (unsigned char *)realloc(cm->data, capacity);
+    if (data == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(EXIT_FAILURE);
+    }
+    cm->data = data;
+    cm->capacity = capacity;
+  }
+
+  size_t offset = cm->size;
+  CompiledRecord *rec = (CompiledRecord *)(cm->data + offset);
+  rec->type = type;
+  rec->size = (int)size;
+  rec->count = 0;
+  rec->flag = 0;
+  cm->size += size;
+  cm->nRecords++;
+  return offset;
+}
+
+// Append a record holding a copy of size bytes of plain data.
+static void compiled_appendData(CompiledModule *cm, int type, const void *obj,
+                                size_t size) {
+  size_t offset = compiled_append(cm, type, size);
+  memcpy(RECORD_PAYLOAD(cm->data + offset), obj, size);
+}
+
+// Append a record holding a run of n vertices.
+static void compiled_appendVertices(CompiledModule *cm, int type, int flag,
+                                    const Point *vertex, int n) {
+  if (vertex == NULL || n < 0) {
+    n = 0;
+  }
+  size_t offset = compiled_append(cm, type, sizeof(Point) * n);
+  CompiledRecord *rec = (CompiledRecord *)(cm->data + offset);
+  rec->count = n;
+  rec->flag = flag;
+  if (n > 0) {
+    memcpy(RECORD_PAYLOAD(rec), vertex, sizeof(Point) * n);
+  }
+  if (n > cm->maxVertex) {
+    cm->maxVertex = n;
+  }
+}
+
+// Saved state of a module whose element list is being compiled.
+typedef struct {
+  Element *next;  // element to continue at
+  long foldAt;    // offset of the matrix record a following ObjMatrix can be
+                  // folded into, or -1
+  int instance;   // next instance to expand if next is an ObjInstances
+  int ends;       // CmdModuleEnd records to append when the list is done
+} CompileFrame;
+
+// Stack of compile_elements. Like the stacks of module_draw it only grows.
+static CompileFrame *compile_stack = NULL;
+static int compile_stack_size = 0;
+
+// Make room for frame depth on compile_stack and return the stack.
+static CompileFrame *compile_stack_reserve(int depth) {
+  if (depth >= compile_stack_size) {
+    int size = compile_stack_size > 0 ? compile_stack_size * 2 : 32;
+    while (depth >= size) {
+      size *= 2;
+    }
+    CompileFrame *stack =
+        (CompileFrame *)realloc(compile_stack, sizeof(CompileFrame) * size);
+    if (stack == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(EXIT_FAILURE);
+    }
+    compile_stack = stack;
+    compile_stack_size = size;
+  }
+  return compile_stack;
+}
+
+// Append the records for md's element list, inlining submodules. Submodules
+// are entered on compile_stack rather than by recursion, so hierarchies may be
+// nested arbitrarily deep.
+static void compile_elements(CompiledModule *cm, Module *md) {
+  int depth = 0;
+  CompileFrame *frame = &compile_stack_reserve(depth)[depth];
+  frame->next = md->head;
+  frame->foldAt = -1;
+  frame->instance = 0;
+  frame->ends = 0;
+
+  while (depth >= 0) {
+    frame = &compile_stack[depth];
+    Element *e = frame->next;
+
+    if (e == NULL) {
+      for (int i = 0; i < frame->ends; i++) {
+        compiled_append(cm, CmdModuleEnd, 0);
+      }
+      depth -= frame->ends > 0 ? frame->ends : 1;
+      continue;
+    }
+
+    if (e->type == ObjMatrix) {
+      if (frame->foldAt >= 0) {
+        // LTM = B * (A * LTM) is the same as LTM = (B * A) * LTM
+        Matrix *prev = (Matrix *)RECORD_PAYLOAD(cm->data + frame->foldAt);
+        matrix_multiply((Matrix *)e->obj, prev, prev);
+      } else {
+        frame->foldAt = (long)cm->size;
+        compiled_appendData(cm, ObjMatrix, e->obj, sizeof(Matrix));
+      }
+      frame->next = e->next;
+      continue;
+    }
+    frame->foldAt = -1;
+
+    switch (e->type) {
+    case ObjNone:
+      break;
+    case ObjLine:
+      compiled_appendData(cm, ObjLine, e->obj, sizeof(Line));
+      break;
+    case ObjPoint:
+      compiled_appendData(cm, ObjPoint, e->obj, sizeof(Point));
+      break;
+    case ObjPolyline: {
+      Polyline *p = (Polyline *)e->obj;
+      compiled_appendVertices(cm, ObjPolyline, p->zBuffer, p->vertex, p->numVertex);
+      break;
+    }
+    case ObjPolygon: {
+      Polygon *p = (Polygon *)e->obj;
+      compiled_appendVertices(cm, ObjPolygon,
+                              (p->oneSided != 0) | (p->zBuffer != 0) << 1,
+                              p->vertex, p->nVertex);
+      break;
+    }
+    case ObjIdentity:
+      compiled_append(cm, ObjIdentity, 0);
+      break;
+    case ObjColor:
+    case ObjBodyColor:
+    case ObjSurfaceColor:
+      compiled_appendData(cm, e->type, e->obj, sizeof(Color));
+      break;
+    case ObjSurfaceCoeff:
+      compiled_appendData(cm, ObjSurfaceCoeff, e->obj, sizeof(float));
+      break;
+    case ObjModule: {
+      compiled_append(cm, ObjModule, 0);
+      frame->next = e->next;
+      frame = &compile_stack_reserve(depth + 1)[depth + 1];
+      frame->next = ((Module *)e->obj)->head;
+      frame->foldAt = -1;
+      frame->instance = 0;
+      frame->ends = 1;
+      depth++;
+      if (depth > cm->maxDepth) {
+        cm->maxDepth = depth;
+      }
+      continue;
+    }
+    case ObjInstances: {
+      // instance i is a submodule holding xforms[i] and then the prototype;
+      // the prototype's frame stands for both levels and ends them together
+      Instances *inst = (Instances *)e->obj;
+      if (frame->instance >= inst->n) {
+        frame->instance = 0;
+        break;
+      }
+      int i = frame->instance++;
+      compiled_append(cm, ObjModule, 0);
+      compiled_appendData(cm, ObjMatrix, &inst->xforms[i], sizeof(Matrix));
+      compiled_append(cm, ObjModule, 0);
+      frame = &compile_stack_reserve(depth + 2)[depth + 2];
+      frame->next = inst->proto->head;
+      frame->foldAt = -1;
+      frame->instance = 0;
+      frame->ends = 2;
+      depth += 2;
+      if (depth > cm->maxDepth) {
+        cm->maxDepth = depth;
+      }
+      continue;
+    }
+    default:
+      fprintf(stderr, "Invalid object type\n");
+      exit(EXIT_FAILURE);
+    }
+    frame->next = e->next;
+  }
+}
+
+CompiledModule *module_compile(Module *md) {
+  if (md == NULL) {
+    return NULL;
+  }
+
+  CompiledModule *cm = (CompiledModule *)malloc(sizeof(CompiledModule));
+  if (cm == NULL) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  cm->data = NULL;
+  cm->size = 0;
+  cm->capacity = 0;
+  cm->nRecords = 0;
+  cm->maxDepth = 0;
+  cm->maxVertex = 0;
+  cm->stack = NULL;
+
+  compile_elements(cm, md);
+
+  if (cm->maxDepth > 0) {
+    cm->stack = (CompiledFrame *)malloc(sizeof(CompiledFrame) * cm->maxDepth);
+    if (cm->stack == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return cm;
+}
+
+void compiled_module_draw(CompiledModule *cm, Matrix *VTM, Matrix *GTM,
+                          DrawState *ds, Lighting *lighting, Image *src) {
+  if (cm == NULL || VTM == NULL || GTM == NULL || ds == NULL || src == NULL) {
+    fprintf(stderr, "Error: NULL argument to compiled_module_draw\n");
+    return;
+  }
+
+  Matrix VGTM;
+  ClipVolume clip;
+  draw_compose(VTM, GTM, &VGTM);
+  clip_volume(&clip, VTM, src->rows, src->cols);
+  compiled_module_drawComposite(cm, &VGTM, &clip, ds, lighting, src);
+}
+
+void compiled_module_drawComposite(CompiledModule *cm, Matrix *VGTM,
+                                   const ClipVolume *clip, DrawState *ds,
+                                   Lighting *lighting, Image *src) {
+  if (cm == NULL || VGTM == NULL || clip == NULL || ds == NULL || src == NULL) {
+    fprintf(stderr, "Error: NULL argument to compiled_module_drawComposite\n");
+    return;
+  }
+
+  // CTM = vgtm * LTM is rebuilt by the first primitive after LTM changes
+  Matrix LTM, vgtm, CTM;
+  int ctmValid = 1;
+  int depth = 0;
+  matrix_identity(&LTM);
+  matrix_copy(&vgtm, VGTM);
+  matrix_copy(&CTM, VGTM);
+
+  size_t offset = 0;
+  while (offset < cm->size) {
+    CompiledRecord *rec = (CompiledRecord *)(cm->data + offset);
+    void *payload = RECORD_PAYLOAD(rec);
+
+    if (!ctmValid && (rec->type == ObjLine || rec->type == ObjPoint ||
+                      rec->type == ObjPolyline || rec->type == ObjPolygon ||
+                      rec->type == ObjModule)) {
+      draw_compose(&vgtm, &LTM, &CTM);
+      ctmValid = 1;
+    }
+
+    switch (rec->type) {
+    case ObjLine:
+      draw_composite_line((Line *)payload, &CTM, clip, ds, src);
+      break;
+    case ObjPoint:
+      draw_composite_point((Point *)payload, &CTM, clip, ds, src);
+      break;
+    case ObjPolyline: {
+      Polyline p = {rec->flag, rec->count, (Point *)payload};
+      draw_composite_polyline(&p, &CTM, clip, ds, src);
+      break;
+    }
+    case ObjPolygon: {
+      Polygon p = {rec->flag & 1, rec->count, (Point *)payload, rec->flag >> 1};
+      draw_composite_polygon(&p, &CTM, clip, ds, src);
+      break;
+    }
+    case ObjIdentity:
+      matrix_identity(&LTM);
+      ctmValid = 0;
+      break;
+    case ObjMatrix:
+      matrix_multiply((Matrix *)payload, &LTM, &LTM);
+      ctmValid = 0;
+      break;
+    case ObjColor:
+      ds->color = *((Color *)payload);
+      break;
+    case ObjBodyColor:
+      ds->body = *((Color *)payload);
+      break;
+    case ObjSurfaceColor:
+      ds->surface = *((Color *)payload);
+      break;
+    case ObjSurfaceCoeff:
+      ds->surfaceCoeff = *((float *)payload);
+      break;
+    case ObjModule: {
+      // the submodule starts from the current composite with its own copy of
+      // the DrawState
+      CompiledFrame *frame = &cm->stack[depth++];
+      matrix_copy(&frame->LTM, &LTM);
+      matrix_copy(&frame->VGTM, &vgtm);
+      matrix_copy(&frame->CTM, &CTM);
+      frame->ds = *ds;
+      matrix_copy(&vgtm, &CTM);
+      matrix_identity(&LTM);
+      break;
+    }
+    case CmdModuleEnd: {
+      CompiledFrame *frame = &cm->stack[--depth];
+      matrix_copy(&LTM, &frame->LTM);
+      matrix_copy(&vgtm, &frame->VGTM);
+      matrix_copy(&CTM, &frame->CTM);
+      ctmValid = 1;
+      *ds = frame->ds;
+      break;
+    }
+    default:
+      fprintf(stderr, "Invalid object type\n");
+      exit(EXIT_FAILURE);
+    }
+    offset += rec->size;
+  }
+}
+
+void compiled_module_free(CompiledModule *cm) {
+  if (cm != NULL) {
+    free(cm->data);
+    free(cm->stack);
+    free(cm);
+  }
+}
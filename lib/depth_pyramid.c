@@ -0,0 +1,195 @@
+#include "../include/depth_pyramid.h"
+#include <float.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(DEPTH_PYRAMID_SHIFT <= IMAGE_TILE_SHIFT,
+               "depth pyramid tiles must not straddle lazy-clear tiles");
+
+void depthpyramid_reset(DepthPyramid *dp, Image *src) {
+  int total = 0;
+
+  dp->rows = src->rows;
+  dp->cols = src->cols;
+  dp->nLevels = 0;
+  for (int level = 0; level < DEPTH_PYRAMID_MAX_LEVELS; level++) {
+    int size = 1 << (DEPTH_PYRAMID_SHIFT + level);
+    dp->tileRows[level] = (src->rows + size - 1) / size;
+    dp->tileCols[level] = (src->cols + size - 1) / size;
+    total += dp->tileRows[level] * dp->tileCols[level];
+    dp->nLevels++;
+    if (dp->tileRows[level] <= 1 && dp->tileCols[level] <= 1) {
+      break;
+    }
+  }
+
+  int tiles = dp->tileRows[0] * dp->tileCols[0];
+  if (total > dp->size || tiles > dp->dirtySize) {
+    float *storage = (float *)realloc(dp->storage, sizeof(float) * total);
+    unsigned char *dirty = (unsigned char *)realloc(dp->dirty, tiles);
+    if (storage == NULL || dirty == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(EXIT_FAILURE);
+    }
+    dp->storage = storage;
+    dp->dirty = dirty;
+    dp->size = total;
+    dp->dirtySize = tiles;
+    dp->allocations++;
+  }
+
+  float *far = dp->storage;
+  for (int level = 0; level < dp->nLevels; level++) {
+    dp->far[level] = far;
+    far += dp->tileRows[level] * dp->tileCols[level];
+  }
+  for (int i = 0; i < total; i++) {
+    dp->storage[i] = -FLT_MAX;
+  }
+  memset(dp->dirty, 1, tiles);
+}
+
+void depthpyramid_touch(DepthPyramid *dp, int row, int col) {
+  dp->dirty[(row >> DEPTH_PYRAMID_SHIFT) * dp->tileCols[0] +
+            (col >> DEPTH_PYRAMID_SHIFT)] = 1;
+}
+
+void depthpyramid_touchSpan(DepthPyramid *dp, int row, int c0, int c1) {
+  unsigned char *dirty = &dp->dirty[(row >> DEPTH_PYRAMID_SHIFT) * dp->tileCols[0]];
+  int t0 = c0 >> DEPTH_PYRAMID_SHIFT, t1 = c1 >> DEPTH_PYRAMID_SHIFT;
+  memset(&dirty[t0], 1, t1 - t0 + 1);
+}
+
+void depthpyramid_lower(DepthPyramid *dp, int row, int col, float z) {
+  // a tile's bound is never above those of the tiles under it, so once one
+  // level already allows z every level above it does as well
+  for (int level = 0; level < dp->nLevels; level++) {
+    int shift = DEPTH_PYRAMID_SHIFT + level;
+    float *far = &dp->far[level][(row >> shift) * dp->tileCols[level] + (col >> shift)];
+    if (*far <= z) {
+      break;
+    }
+    *far = z;
+  }
+}
+
+void depthpyramid_fillSpan(DepthPyramid *dp, int row, int c0, int c1, float z) {
+  depthpyramid_touchSpan(dp, row, c0, c1);
+  for (int t = c0 >> DEPTH_PYRAMID_SHIFT; t <= c1 >> DEPTH_PYRAMID_SHIFT; t++) {
+    depthpyramid_lower(dp, row, t << DEPTH_PYRAMID_SHIFT, z);
+  }
+}
+
+// Rescan the pixels of level 0 tile (tr, tc) for its bound.
+static float depthpyramid_scan(DepthPyramid *dp, Image *src, int tr, int tc) {
+  int r0 = tr << DEPTH_PYRAMID_SHIFT, c0 = tc << DEPTH_PYRAMID_SHIFT;
+  int r1 = r0 + (1 << DEPTH_PYRAMID_SHIFT), c1 = c0 + (1 << DEPTH_PYRAMID_SHIFT);
+  float low = FLT_MAX;
+
+  if (r1 > src->rows) {
+    r1 = src->rows;
+  }
+  if (c1 > src->cols) {
+    c1 = src->cols;
+  }
+  // the tile lies inside one tile of the lazy clear, and if that is still
+  // cleared its storage is stale
+  if (image_cleared(src, r0, c0)) {
+    return image_getz(src, r0, c0);
+  }
+  for (int r = r0; r < r1; r++) {
+    if (src->layout == ImagePlanar) {
+      const float *z = src->depth + (size_t)r * src->stride;
+      for (int c = c0; c < c1; c++) {
+        low = z[c] < low ? z[c] : low;
+      }
+      continue;
+    }
+    if (src->layout == ImageRGBA8) {
+      // the smallest code decodes to the smallest value
+      unsigned int code = UINT_MAX;
+      for (int c = c0; c < c1; c++) {
+        unsigned int z = image_depthGet(src, (size_t)r * src->stride + c);
+        code = z < code ? z : code;
+      }
+      float z = image_depthValue(code, src->depthBits);
+      low = z < low ? z : low;
+      continue;
+    }
+    const FPixel *row = src->pixels + (size_t)r * src->stride;
+    for (int c = c0; c < c1; c++) {
+      if (row[c].z < low) {
+        low = row[c].z;
+      }
+    }
+  }
+  return low;
+}
+
+// Return non-zero if the part of the rectangle under tile (tr, tc) of level is
+// covered closer than nearest. Walking down to the tiles the rectangle reaches
+// refreshes their bounds, and a tile whose children all pass takes the
+// smallest of their bounds as its own.
+static int depthpyramid_cover(DepthPyramid *dp, Image *src, int level, int tr,
+                              int tc, int x0, int y0, int x1, int y1,
+                              float nearest) {
+  float *far = &dp->far[level][tr * dp->tileCols[level] + tc];
+  if (*far > nearest) {
+    return 1;
+  }
+
+  if (level == 0) {
+    unsigned char *dirty = &dp->dirty[tr * dp->tileCols[0] + tc];
+    if (!*dirty) {
+      return 0;
+    }
+    *far = depthpyramid_scan(dp, src, tr, tc);
+    *dirty = 0;
+    return *far > nearest;
+  }
+
+  // the children of the tile, and the ones of those the rectangle reaches
+  int shift = DEPTH_PYRAMID_SHIFT + level - 1;
+  int rowEnd = 2 * tr + 1 < dp->tileRows[level - 1] ? 2 * tr + 1 : 2 * tr;
+  int colEnd = 2 * tc + 1 < dp->tileCols[level - 1] ? 2 * tc + 1 : 2 * tc;
+  int cr0 = (y0 >> shift) > 2 * tr ? y0 >> shift : 2 * tr;
+  int cr1 = (y1 >> shift) < rowEnd ? y1 >> shift : rowEnd;
+  int cc0 = (x0 >> shift) > 2 * tc ? x0 >> shift : 2 * tc;
+  int cc1 = (x1 >> shift) < colEnd ? x1 >> shift : colEnd;
+  for (int r = cr0; r <= cr1; r++) {
+    for (int c = cc0; c <= cc1; c++) {
+      if (!depthpyramid_cover(dp, src, level - 1, r, c, x0, y0, x1, y1, nearest)) {
+        return 0;
+      }
+    }
+  }
+
+  float low = FLT_MAX;
+  for (int r = 2 * tr; r <= rowEnd; r++) {
+    for (int c = 2 * tc; c <= colEnd; c++) {
+      float child = dp->far[level - 1][r * dp->tileCols[level - 1] + c];
+      if (child < low) {
+        low = child;
+      }
+    }
+  }
+  *far = low;
+  return 1;
+}
+
+int depthpyramid_hidden(DepthPyramid *dp, Image *src, int x0, int y0, int x1,
+                        int y1, float nearest) {
+  if (dp->nLevels == 0 || x0 > x1 || y0 > y1) {
+    return 0;
+  }
+  return depthpyramid_cover(dp, src, dp->nLevels - 1, 0, 0, x0, y0, x1, y1,
+                            nearest);
+}
+
+void depthpyramid_free(DepthPyramid *dp) {
+  free(dp->storage);
+  free(dp->dirty);
+  memset(dp, 0, sizeof(DepthPyramid));
+}
@@ -81,8 +81,27 @@ static bool is_empty(Queue* q) {
     return q->front == NULL;
 }
 
-// Flood-fill algorithm
+// Queue the first pixel of every run of fillable pixels in row y between
+// columns left and right.
+static void enqueue_runs(Queue* q, Image *src, int left, int right, int y,
+                         Color targetColor, Color fillColor) {
+    int inRun = 0;
+    for (int x = left; x <= right; x++) {
+        int valid = is_valid_pixel(src, x, y, targetColor, fillColor);
+        if (valid && !inRun) {
+            enqueue(q, x, y);
+        }
+        inRun = valid;
+    }
+}
+
+// Flood-fill algorithm. Each seed taken from the queue is grown to the whole
+// horizontal run of fillable pixels around it, which is filled as one span;
+// the rows above and below it then get one seed per run they hold.
 void flood_fill(Image *src, int x, int y, Color fillColor) {
+    // compare with the fill color as the image will hold it, or pixels that
+    // already have it would look fillable
+    fillColor = image_roundColor(src, fillColor);
     Color targetColor = image_getColor(src, y, x);
     if (targetColor.c[0] == fillColor.c[0] && 
         targetColor.c[1] == fillColor.c[1] && 
@@ -90,27 +109,30 @@ void flood_fill(Image *src, int x, int y, Color fillColor) {
         return;
     }
 
+    FPixel fill = {{fillColor.c[0], fillColor.c[1], fillColor.c[2]}, 1.0f, IMAGE_Z_CLEAR};
     Queue* q = create_queue();
     enqueue(q, x, y);
 
     while (!is_empty(q)) {
         FloodFillPoint pt = dequeue(q);
-        int curr_x = pt.x;
-        int curr_y = pt.y;
 
-        if (is_valid_pixel(src, curr_x, curr_y, targetColor, fillColor)) {
-            image_setColor(src, curr_y, curr_x, fillColor);
+        // an earlier span may have filled the seed already
+        if (!is_valid_pixel(src, pt.x, pt.y, targetColor, fillColor)) {
+            continue;
+        }
 
-            enqueue(q, curr_x + 1, curr_y);
-            enqueue(q, curr_x - 1, curr_y);
-            enqueue(q, curr_x, curr_y + 1);
-            enqueue(q, curr_x, curr_y - 1);
+        int left = pt.x, right = pt.x;
+        while (is_valid_pixel(src, left - 1, pt.y, targetColor, fillColor)) {
+            left--;
         }
-    }
+        while (is_valid_pixel(src, right + 1, pt.y, targetColor, fillColor)) {
+            right++;
+        }
+        image_fillSpan(src, pt.y, left, right, fill);
 
-    // Free the queue
-    while (!is_empty(q)) {
-        dequeue(q);
+        enqueue_runs(q, src, left, right, pt.y - 1, targetColor, fillColor);
+        enqueue_runs(q, src, left, right, pt.y + 1, targetColor, fillColor);
     }
+
     free(q);
 }
@@ -0,0 +1,97 @@
+#include "../include/geometry_float.h"
+
+// The SSE kernel adds the column products in the same order as the scalar
+// code and never uses FMA, so both give bit-identical results.
+#if !defined(TRANSFORM_SCALAR) && defined(__SSE__)
+#define GEOMETRY_FLOAT_SSE
+#include <xmmintrin.h>
+#endif
+
+void pointf_fromPoint(PointF *to, const Point *from) {
+  for (int i = 0; i < 4; i++) {
+    to->val[i] = (float)from->val[i];
+  }
+}
+
+void point_fromPointF(Point *to, const PointF *from) {
+  for (int i = 0; i < 4; i++) {
+    to->val[i] = from->val[i];
+  }
+}
+
+void matrixf_fromMatrix(MatrixF *to, const Matrix *from) {
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      to->m[i][j] = (float)from->m[i][j];
+    }
+  }
+}
+
+void pointf_normalize(PointF *p) {
+  if (p->val[3] != 0) {
+    p->val[0] /= p->val[3];
+    p->val[1] /= p->val[3];
+    p->val[3] = 1.0f;
+  }
+}
+
+void matrixf_multiply(const MatrixF *left, const MatrixF *right, MatrixF *m) {
+  MatrixF temp;
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      float sum = 0.0f;
+      for (int k = 0; k < 4; k++) {
+        sum += left->m[i][k] * right->m[k][j];
+      }
+      temp.m[i][j] = sum;
+    }
+  }
+  *m = temp;
+}
+
+// q = m * p in scalar code. p and q may be the same.
+static inline void xformf_scalar(const MatrixF *m, const float *p, float *q) {
+  float x = p[0], y = p[1], z = p[2], w = p[3];
+  float q0 = m->m[0][0] * x + m->m[0][1] * y + m->m[0][2] * z + m->m[0][3] * w;
+  float q1 = m->m[1][0] * x + m->m[1][1] * y + m->m[1][2] * z + m->m[1][3] * w;
+  float q2 = m->m[2][0] * x + m->m[2][1] * y + m->m[2][2] * z + m->m[2][3] * w;
+  float q3 = m->m[3][0] * x + m->m[3][1] * y + m->m[3][2] * z + m->m[3][3] * w;
+  q[0] = q0;
+  q[1] = q1;
+  q[2] = q2;
+  q[3] = q3;
+}
+
+void matrixf_xformPoint(const MatrixF *m, const PointF *p, PointF *q) {
+  xformf_scalar(m, p->val, q->val);
+}
+
+void matrixf_xformPoints(const MatrixF *m, const PointF *in, PointF *out,
+                         int n, int divide) {
+#if defined(GEOMETRY_FLOAT_SSE)
+  // column j of m holds the weights of input coordinate j
+  __m128 c0 = _mm_setr_ps(m->m[0][0], m->m[1][0], m->m[2][0], m->m[3][0]);
+  __m128 c1 = _mm_setr_ps(m->m[0][1], m->m[1][1], m->m[2][1], m->m[3][1]);
+  __m128 c2 = _mm_setr_ps(m->m[0][2], m->m[1][2], m->m[2][2], m->m[3][2]);
+  __m128 c3 = _mm_setr_ps(m->m[0][3], m->m[1][3], m->m[2][3], m->m[3][3]);
+
+  for (int i = 0; i < n; i++) {
+    const float *p = in[i].val;
+    __m128 sum = _mm_mul_ps(c0, _mm_set1_ps(p[0]));
+    sum = _mm_add_ps(sum, _mm_mul_ps(c1, _mm_set1_ps(p[1])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(c2, _mm_set1_ps(p[2])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(c3, _mm_set1_ps(p[3])));
+    _mm_storeu_ps(out[i].val, sum);
+    if (divide) {
+      pointf_normalize(&out[i]);
+    }
+  }
+#else
+  for (int i = 0; i < n; i++) {
+    xformf_scalar(m, in[i].val, out[i].val);
+    if (divide) {
+      pointf_normalize(&out[i]);
+    }
+  }
+#endif
+}
@@ -10,6 +10,28 @@ static void draw_pixel(Image *src, int x, int y, Color p) {
   }
 }
 
+// The pixel the fills write: color p, opaque, with no depth, like a line
+// drawn without the depth test.
+static FPixel fill_value(Color p) {
+  FPixel val = {{p.c[0], p.c[1], p.c[2]}, 1.0f, IMAGE_Z_CLEAR};
+  return val;
+}
+
+// Largest x >= 0 with x * x * scale <= limit, which must be >= 0, and no more
+// than bound.
+static int fill_extent(long long limit, long long scale, int bound) {
+  if (scale <= 0)
+    return bound;
+  int x = (int)sqrt((double)limit / (double)scale);
+  if (x > bound)
+    x = bound;
+  while (x > 0 && (long long)x * x * scale > limit)
+    x--;
+  while (x < bound && (long long)(x + 1) * (x + 1) * scale <= limit)
+    x++;
+  return x;
+}
+
 void circle_set(Circle *c, Point tc, double tr) {
   point_copy(&(c->c), &tc);
   c->r = tr;
@@ -47,13 +69,12 @@ void circle_drawFill(Circle *c, Image *src, Color p) {
   int x0 = (int)c->c.val[0];
   int y0 = (int)c->c.val[1];
   int r = (int)c->r;
+  FPixel val = fill_value(p);
 
+  // each row is the span of x with x * x + y * y <= r * r
   for (int y = -r; y <= r; y++) {
-    for (int x = -r; x <= r; x++) {
-      if (x * x + y * y <= r * r) {
-        draw_pixel(src, x0 + x, y0 + y, p);
-      }
-    }
+    int x = fill_extent((long long)r * r - (long long)y * y, 1, r);
+    image_fillSpan(src, y0 + y, x0 - x, x0 + x, val);
   }
 }
 
@@ -120,13 +141,15 @@ void ellipse_drawFill(Ellipse *e, Image *src, Color p) {
   int y0 = (int)e->c.val[1];
   int ra = (int)e->ra;
   int rb = (int)e->rb;
+  FPixel val = fill_value(p);
+  long long ra2 = (long long)ra * ra, rb2 = (long long)rb * rb;
 
+  // each row is the span of x with x * x * rb2 + y * y * ra2 <= ra2 * rb2
+  if (ra < 0)
+    return;
   for (int y = -rb; y <= rb; y++) {
-    for (int x = -ra; x <= ra; x++) {
-      if ((x * x) * (rb * rb) + (y * y) * (ra * ra) <= (ra * ra) * (rb * rb)) {
-        draw_pixel(src, x0 + x, y0 + y, p);
-      }
-    }
+    int x = fill_extent(ra2 * rb2 - (long long)y * y * ra2, rb2, ra);
+    image_fillSpan(src, y0 + y, x0 - x, x0 + x, val);
   }
 }
 
@@ -1,8 +1,22 @@
 #include "../include/hierarchical_modeling.h"
+#include "../include/compiled_module.h"
+#include "../include/depth_pyramid.h"
+#include "../include/trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Incremented on every change to any module. A module whose boundsEpoch equals
+// the current epoch has bounds that include all of its submodules, and a
+// changeEpoch that accounts for them.
+static unsigned long module_epoch = 1;
+
+// Statistics collected by module_draw, see drawstats_get.
+static DrawStats draw_stats;
+
+static void module_bounds_reset(Module* md);
+static void module_bounds_insert(Module* md, Element* e);
+
 // Function to create an initialized but empty Element
 Element* element_create() {
     Element* new_element = (Element*)malloc(sizeof(Element));
@@ -23,6 +37,7 @@ void* duplicate_polyline(const Polyline* src);
 void* duplicate_polygon(const Polygon* src);
 void* duplicate_matrix(const Matrix* src);
 void* duplicate_color(const Color* src);
+void* duplicate_instances(const Instances* src);
 
 // Allocate an Element and store a duplicate of the data pointed to by obj in
 // the Element. Modules do not get duplicated. The function needs to handle each
@@ -72,6 +87,9 @@ Element* element_init(ObjectType type, void* obj) {
         case ObjModule:
             new_element->obj = obj; // do not duplicate module
             break;
+        case ObjInstances:
+            new_element->obj = duplicate_instances((Instances*)obj);
+            break;
         default:
             fprintf(stderr, "Invalid object type\n");
             exit(EXIT_FAILURE);
@@ -151,6 +169,69 @@ void* duplicate_color(const Color* src) {
     return new_color;
 }
 
+// Function to duplicate an Instances object. The prototype is shared.
+void* duplicate_instances(const Instances* src) {
+    Instances* new_instances = (Instances*)malloc(sizeof(Instances));
+    if (new_instances == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    new_instances->proto = src->proto;
+    new_instances->n = src->xforms != NULL && src->n > 0 ? src->n : 0;
+    new_instances->xforms = NULL;
+    if (new_instances->n > 0) {
+        new_instances->xforms = (Matrix*)malloc(sizeof(Matrix) * new_instances->n);
+        if (new_instances->xforms == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(new_instances->xforms, src->xforms, sizeof(Matrix) * new_instances->n);
+    }
+    new_instances->compiled = NULL;
+    new_instances->compiledEpoch = 0;
+    return new_instances;
+}
+
+// Allocate size bytes of payload storage for md, from its arena if it has one.
+static void* module_alloc(Module* md, size_t size) {
+    void* mem = md->arena != NULL ? scenearena_alloc(md->arena, size) : malloc(size);
+    if (mem == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return mem;
+}
+
+// Copy plain data (points, lines, matrices, colors) into md's storage.
+static void* module_copy(Module* md, const void* src, size_t size) {
+    void* mem = module_alloc(md, size);
+    memcpy(mem, src, size);
+    return mem;
+}
+
+// Copy a vertex list into md's storage.
+static Point* module_copyVertices(Module* md, const Point* vertex, int n) {
+    if (n <= 0 || vertex == NULL) {
+        return NULL;
+    }
+    return (Point*)module_copy(md, vertex, sizeof(Point) * n);
+}
+
+// Wrap obj in an Element taken from md's storage and add it to the tail of the
+// module's list.
+static void module_append(Module* md, ObjectType type, void* obj) {
+    Element* new_element;
+    if (md->arena != NULL) {
+        new_element = (Element*)module_alloc(md, sizeof(Element));
+        new_element->next = NULL;
+    } else {
+        new_element = element_create();
+    }
+    new_element->type = type;
+    new_element->obj = obj;
+    module_insert(md, new_element);
+}
 
 // free the element and the object it contains, as appropriate.
 void element_delete(Element* e) {
@@ -191,12 +272,18 @@ void element_delete(Element* e) {
             free(e->obj);
             break;
         case ObjSurfaceCoeff:
+            free(e->obj);
             break;
         // case ObjLight:
         //     break;
         case ObjModule:
             // module_clear((Module*)e->obj);
             break;
+        case ObjInstances:
+            compiled_module_free(((Instances*)e->obj)->compiled);
+            free(((Instances*)e->obj)->xforms);
+            free(e->obj);
+            break;
         default:
             fprintf(stderr, "Invalid object type\n");
             exit(EXIT_FAILURE);
@@ -214,11 +301,38 @@ Module* module_create() {
     }
     new_module->head = NULL;
     new_module->tail = NULL;
+    new_module->arena = NULL;
+    module_bounds_reset(new_module);
+    return new_module;
+}
+
+// Allocate an empty module whose elements and payloads come out of arena.
+Module* module_create_in(SceneArena* arena) {
+    Module* new_module = (Module*)scenearena_alloc(arena, sizeof(Module));
+    new_module->head = NULL;
+    new_module->tail = NULL;
+    new_module->arena = arena;
+    module_bounds_reset(new_module);
     return new_module;
 }
 
 // clear the module’s list of Elements, freeing memory as appropriate.
 void module_clear(Module* md) {
+    module_bounds_reset(md);
+
+    // arena storage is released all at once by scenearena_reset, only the
+    // compiled prototypes of instances live outside the arena
+    if (md->arena != NULL) {
+        for (Element* e = md->head; e != NULL; e = e->next) {
+            if (e->type == ObjInstances) {
+                compiled_module_free(((Instances*)e->obj)->compiled);
+            }
+        }
+        md->head = NULL;
+        md->tail = NULL;
+        return;
+    }
+
     Element* current = md->head;
     while (current != NULL) {
         Element* next = current->next;
@@ -232,7 +346,9 @@ void module_clear(Module* md) {
 // Free all of the memory associated with a module, including the memory pointed to by md.
 void module_delete(Module* md) {
     module_clear(md);
-    free(md);
+    if (md->arena == NULL) {
+        free(md);
+    }
 }
 
 // Generic insert of an element into the module at the tail of the list.
@@ -244,170 +360,727 @@ void module_insert(Module* md, Element* e) {
         md->tail->next = e;
         md->tail = e;
     }
+    module_bounds_insert(md, e);
+}
+
+static void bounds_clear(Bounds* b) {
+    b->empty = 1;
+    b->depthTested = 1;
+}
+
+// Grow b to contain the point p transformed by m.
+static void bounds_addPoint(Bounds* b, Matrix* m, Point* p) {
+    Point q;
+    matrix_xformPoint(m, p, &q);
+    point_normalize(&q);
+    if (b->empty) {
+        for (int i = 0; i < 3; i++) {
+            b->min[i] = b->max[i] = q.val[i];
+        }
+        b->empty = 0;
+        return;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (q.val[i] < b->min[i]) b->min[i] = q.val[i];
+        if (q.val[i] > b->max[i]) b->max[i] = q.val[i];
+    }
+}
+
+// Return corner i (0 to 7) of the box.
+static void bounds_corner(Bounds* b, int i, Point* p) {
+    point_set3D(p, (i & 1) ? b->max[0] : b->min[0],
+                   (i & 2) ? b->max[1] : b->min[1],
+                   (i & 4) ? b->max[2] : b->min[2]);
+}
+
+// Grow b to contain the box from transformed by m.
+static void bounds_addBounds(Bounds* b, Matrix* m, Bounds* from) {
+    if (from->empty) {
+        return;
+    }
+    b->depthTested &= from->depthTested;
+    for (int i = 0; i < 8; i++) {
+        Point p;
+        bounds_corner(from, i, &p);
+        bounds_addPoint(b, m, &p);
+    }
+}
+
+// Grow b to contain every instance of a prototype with bounds from, placed by
+// LTM and then the instance matrix.
+static void bounds_addInstances(Bounds* b, Matrix* LTM, Instances* inst, Bounds* from) {
+    for (int i = 0; i < inst->n; i++) {
+        Matrix m;
+        matrix_multiply(LTM, &inst->xforms[i], &m);
+        bounds_addBounds(b, &m, from);
+    }
+}
+
+// Grow b to contain the primitive in element e transformed by m.
+static void bounds_addElement(Bounds* b, Matrix* m, Element* e) {
+    switch (e->type) {
+        case ObjLine:
+            bounds_addPoint(b, m, &((Line*)e->obj)->a);
+            bounds_addPoint(b, m, &((Line*)e->obj)->b);
+            b->depthTested &= ((Line*)e->obj)->zBuffer != 0;
+            break;
+        case ObjPoint:
+            bounds_addPoint(b, m, (Point*)e->obj);
+            b->depthTested = 0;
+            break;
+        case ObjPolyline: {
+            Polyline* p = (Polyline*)e->obj;
+            b->depthTested &= p->zBuffer != 0;
+            for (int i = 0; p->vertex != NULL && i < p->numVertex; i++) {
+                bounds_addPoint(b, m, &p->vertex[i]);
+            }
+            break;
+        }
+        case ObjPolygon: {
+            Polygon* p = (Polygon*)e->obj;
+            b->depthTested &= p->zBuffer != 0;
+            for (int i = 0; p->vertex != NULL && i < p->nVertex; i++) {
+                bounds_addPoint(b, m, &p->vertex[i]);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Start the bounds of an empty module.
+static void module_bounds_reset(Module* md) {
+    matrix_identity(&md->boundsLTM);
+    bounds_clear(&md->geometry);
+    bounds_clear(&md->bounds);
+    md->nSubmodules = 0;
+    md->boundsEpoch = ++module_epoch;
+    md->changeEpoch = module_epoch;
+}
+
+// Grow the bounds of md by the element just added to its tail. The LTM that
+// module_draw will have at that element only depends on the elements before
+// it, so it is tracked here in boundsLTM. A submodule is not added here: its
+// bounds may be out of date, and bringing them up to date walks its whole
+// subtree, which would make building a hierarchy bottom up quadratic in its
+// depth. md is left out of date instead, and module_bounds adds all of its
+// submodules in one walk when it is next drawn.
+static void module_bounds_insert(Module* md, Element* e) {
+    int current = md->boundsEpoch == module_epoch;
+
+    md->changeEpoch = ++module_epoch;
+    switch (e->type) {
+        case ObjIdentity:
+            matrix_identity(&md->boundsLTM);
+            break;
+        case ObjMatrix:
+            matrix_multiply((Matrix*)e->obj, &md->boundsLTM, &md->boundsLTM);
+            break;
+        case ObjModule:
+        case ObjInstances:
+            md->nSubmodules++;
+            current = 0;
+            break;
+        default:
+            bounds_addElement(&md->geometry, &md->boundsLTM, e);
+            if (current) {
+                bounds_addElement(&md->bounds, &md->boundsLTM, e);
+            }
+            break;
+    }
+
+    // the incremental update is only complete if nothing below md had changed
+    if (current) {
+        md->boundsEpoch = module_epoch;
+    }
+}
+
+// Saved state of a module whose submodule bounds are being recomputed.
+typedef struct {
+    Module* md;
+    Element* next;  // element to continue at
+    Matrix LTM;     // LTM in effect at next
+} BoundsFrame;
+
+Bounds* module_bounds(Module* md) {
+    static BoundsFrame* stack = NULL;
+    static int stack_size = 0;
+    int depth = 0;
+
+    if (md->boundsEpoch == module_epoch) {
+        return &md->bounds;
+    }
+
+    // walk the out of date modules depth first without recursion, finishing
+    // each submodule before it is added to its parent
+    if (stack == NULL) {
+        stack_size = 32;
+        stack = (BoundsFrame*)malloc(sizeof(BoundsFrame) * stack_size);
+        if (stack == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        draw_stats.allocations++;
+    }
+    stack[0].md = md;
+    stack[0].next = md->head;
+    matrix_identity(&stack[0].LTM);
+    md->bounds = md->geometry;
+    depth = 1;
+
+    while (depth > 0) {
+        BoundsFrame* frame = &stack[depth - 1];
+        Element* e = frame->next;
+
+        if (frame->md->nSubmodules == 0 || e == NULL) {
+            frame->md->boundsEpoch = module_epoch;
+            depth--;
+            continue;
+        }
+
+        if (e->type == ObjModule || e->type == ObjInstances) {
+            Module* sub = e->type == ObjModule ? (Module*)e->obj : ((Instances*)e->obj)->proto;
+            if (sub->boundsEpoch != module_epoch) {
+                if (depth == stack_size) {
+                    stack_size *= 2;
+                    stack = (BoundsFrame*)realloc(stack, sizeof(BoundsFrame) * stack_size);
+                    if (stack == NULL) {
+                        fprintf(stderr, "Memory allocation failed\n");
+                        exit(EXIT_FAILURE);
+                    }
+                    draw_stats.allocations++;
+                }
+                stack[depth].md = sub;
+                stack[depth].next = sub->head;
+                matrix_identity(&stack[depth].LTM);
+                sub->bounds = sub->geometry;
+                depth++;
+                continue;
+            }
+            // a change below the submodule is a change below this module
+            if (sub->changeEpoch > frame->md->changeEpoch) {
+                frame->md->changeEpoch = sub->changeEpoch;
+            }
+            if (e->type == ObjModule) {
+                bounds_addBounds(&frame->md->bounds, &frame->LTM, &sub->bounds);
+            } else {
+                bounds_addInstances(&frame->md->bounds, &frame->LTM, (Instances*)e->obj, &sub->bounds);
+            }
+        } else if (e->type == ObjIdentity) {
+            matrix_identity(&frame->LTM);
+        } else if (e->type == ObjMatrix) {
+            matrix_multiply((Matrix*)e->obj, &frame->LTM, &frame->LTM);
+        }
+        frame->next = e->next;
+    }
+
+    return &md->bounds;
 }
 
 // Adds a pointer to the Module sub to the tail of the module’s list.
 void module_module(Module* md, Module* sub) {
-    Element* new_element = element_create();
-    new_element->type = ObjModule;
-    new_element->obj = sub;
-    module_insert(md, new_element);
+    module_append(md, ObjModule, sub);
+}
+
+void module_instances(Module* md, Module* proto, Matrix* xforms, int n) {
+    Instances* inst = (Instances*)module_alloc(md, sizeof(Instances));
+    inst->proto = proto;
+    inst->n = xforms != NULL && n > 0 ? n : 0;
+    inst->xforms = inst->n > 0 ? (Matrix*)module_copy(md, xforms, sizeof(Matrix) * inst->n) : NULL;
+    inst->compiled = NULL;
+    inst->compiledEpoch = 0;
+    module_append(md, ObjInstances, inst);
 }
 
 void module_point(Module* md, Point* p) {
-    Point* p_copy = duplicate_point(p);
-    Element* new_element = element_create();
-    new_element->type = ObjPoint;
-    new_element->obj = p_copy;
-    module_insert(md, new_element);
+    module_append(md, ObjPoint, module_copy(md, p, sizeof(Point)));
 }
 
 void module_line(Module* md, Line* l) {
-    Line* l_copy = duplicate_line(l);
-    Element* new_element = element_create();
-    new_element->type = ObjLine;
-    new_element->obj = l_copy;
-    module_insert(md, new_element);
+    module_append(md, ObjLine, module_copy(md, l, sizeof(Line)));
 }
 
 void module_polyline(Module* md, Polyline* p) {
-    Polyline* p_copy = duplicate_polyline(p);
-    Element* new_element = element_create();
-    new_element->type = ObjPolyline;
-    new_element->obj = p_copy;
-    module_insert(md, new_element);
+    Polyline* p_copy = (Polyline*)module_alloc(md, sizeof(Polyline));
+    p_copy->zBuffer = p->zBuffer;
+    p_copy->numVertex = p->vertex != NULL ? p->numVertex : 0;
+    p_copy->vertex = module_copyVertices(md, p->vertex, p_copy->numVertex);
+    module_append(md, ObjPolyline, p_copy);
 }
 
 void module_polygon(Module* md, Polygon* p) {
-    Polygon* p_copy = duplicate_polygon(p);
-    Element* new_element = element_create();
-    new_element->type = ObjPolygon;
-    new_element->obj = p_copy;
-    module_insert(md, new_element);
+    Polygon* p_copy = (Polygon*)module_alloc(md, sizeof(Polygon));
+    p_copy->oneSided = p->oneSided;
+    p_copy->zBuffer = p->zBuffer;
+    p_copy->nVertex = p->vertex != NULL ? p->nVertex : 0;
+    p_copy->vertex = module_copyVertices(md, p->vertex, p_copy->nVertex);
+    module_append(md, ObjPolygon, p_copy);
 }
 
 // Object that sets the current transform to the identity, placed at the tail of the module’s list.
 void module_identity(Module* md) {
-    Element* new_element = element_create();
-    new_element->type = ObjIdentity;
-    new_element->obj = NULL;
-    module_insert(md, new_element);
+    module_append(md, ObjIdentity, NULL);
 }
 
 // Matrix operand to add a translation matrix to the tail of the module’s list.
 void module_translate2D(Module* md, double tx, double ty) {
-    Matrix* m = (Matrix*)malloc(sizeof(Matrix));
+    Matrix* m = (Matrix*)module_alloc(md, sizeof(Matrix));
     matrix_identity(m);
     matrix_translate2D(m, tx, ty);
 
-    Element* new_element = element_create();
-    new_element->type = ObjMatrix;
-    new_element->obj = m;
-    module_insert(md, new_element);
+    module_append(md, ObjMatrix, m);
 }
 
 // Matrix operand to add a scale matrix to the tail of the module’s list.
 void module_scale2D(Module* md, double sx, double sy) {
-    Matrix* m = (Matrix*)malloc(sizeof(Matrix));
+    Matrix* m = (Matrix*)module_alloc(md, sizeof(Matrix));
     matrix_identity(m);
     matrix_scale2D(m, sx, sy);
 
-    Element* new_element = element_create();
-    new_element->type = ObjMatrix;
-    new_element->obj = m;
-    module_insert(md, new_element);
+    module_append(md, ObjMatrix, m);
 }
 
 // Matrix operand to add a rotation matrix to the tail of the module’s list.
 void module_rotate2D(Module* md, double cth, double sth) {
-    Matrix* m = (Matrix*)malloc(sizeof(Matrix));
+    Matrix* m = (Matrix*)module_alloc(md, sizeof(Matrix));
     matrix_identity(m);
     matrix_rotateZ(m, cth, sth);
 
-    Element* new_element = element_create();
-    new_element->type = ObjMatrix;
-    new_element->obj = m;
-    module_insert(md, new_element);
+    module_append(md, ObjMatrix, m);
 }
 
 // Matrix operand to add a rotation about the Z axis to the tail of the module’s list
 void module_rotateZ(Module* md, double cth, double sth) {
-    Matrix* m = (Matrix*)malloc(sizeof(Matrix));
+    Matrix* m = (Matrix*)module_alloc(md, sizeof(Matrix));
     matrix_identity(m);
     matrix_rotateZ(m, cth, sth);
 
-    Element* new_element = element_create();
-    new_element->type = ObjMatrix;
-    new_element->obj = m;
-    module_insert(md, new_element);
+    module_append(md, ObjMatrix, m);
 }
 
+// Scratch vertex buffer shared by every draw. It only grows, so once it has
+// reached the size of the largest primitive a draw does no heap allocation.
+static Point* draw_scratch = NULL;
+static int draw_scratch_size = 0;
+
+// Return scratch room for n transformed vertices.
+static Point* draw_scratch_reserve(int n) {
+    if (n > draw_scratch_size) {
+        int size = draw_scratch_size > 0 ? draw_scratch_size : 16;
+        while (size < n) {
+            size *= 2;
+        }
+        Point* vertex = (Point*)realloc(draw_scratch, sizeof(Point) * size);
+        if (vertex == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        draw_scratch = vertex;
+        draw_scratch_size = size;
+        draw_stats.allocations++;
+    }
+    return draw_scratch;
+}
 
-// Helper function to apply transformations and draw a point
-void draw_transformed_point(Point *p, Matrix *VTM, Matrix *GTM, Matrix *LTM, DrawState *ds, Image *src) {
+void drawstats_reset(void) {
+    memset(&draw_stats, 0, sizeof(DrawStats));
+}
+
+void drawstats_get(DrawStats* stats) {
+    *stats = draw_stats;
+}
+
+// Sink that receives the projected primitives instead of the image while
+// module_drawSink is running, NULL otherwise.
+static DrawSink* draw_sink = NULL;
+
+void draw_compose(Matrix *left, Matrix *right, Matrix *m) {
+    matrix_multiply(left, right, m);
+    draw_stats.composes++;
+}
+
+// Scratch space for the clipped polygons. Like the vertex scratch buffer it
+// only grows.
+static ClipScratch draw_clip_scratch;
+
+// Draw the segment from a to b, whose vertices are already divided by h.
+static void draw_segment(Point *a, Point *b, int zBuffer, DrawState *ds, Image *src) {
+    Line l;
+    line_set(&l, *a, *b);
+    line_zBuffer(&l, zBuffer);
+    if (draw_sink != NULL) {
+        draw_sink->line(draw_sink, &l, ds->color);
+        return;
+    }
+    line_draw(&l, src, ds->color);
+}
+
+// Helper function to draw a point through the composite matrix
+void draw_composite_point(Point *p, Matrix *CTM, const ClipVolume *clip, DrawState *ds, Image *src) {
     Point temp;
-    matrix_xformPoint(LTM, p, &temp);    // LTM * Porg
-    printf("LTM: \n");
-    matrix_print(LTM, stdout);
-    printf("temp: %f, %f, %f, %f\n", p->val[0], p->val[1], p->val[2], p->val[3]);
-    matrix_xformPoint(GTM, &temp, &temp); // GTM * (LTM * Porg)
-    printf("GTM: \n");
-    matrix_print(GTM, stdout);
-    printf("temp: %f, %f, %f, %f\n", temp.val[0], temp.val[1], temp.val[2], temp.val[3]);
-    matrix_xformPoint(VTM, &temp, &temp); // VTM * (GTM * (LTM * Porg))
-    printf("VTM: \n");
-    matrix_print(VTM, stdout);
-    printf("temp: %f, %f, %f, %f\n", temp.val[0], temp.val[1], temp.val[2], temp.val[3]);
+    TRACE_PRIMITIVE_MATRIX("point CTM", CTM);
+    matrix_xformPoint(CTM, p, &temp); // VTM * GTM * LTM * Porg
+    draw_stats.vertexTransforms++;
+    if (clip_outcode(clip, &temp) != 0) {
+        draw_stats.clippedPrimitives++;
+        return;
+    }
     point_normalize(&temp);
-    printf("norm temp: %f, %f, %f, %f\n", temp.val[0], temp.val[1], temp.val[2], temp.val[3]);
+    TRACE_PRIMITIVE("draw point", "x,y,z,r,g,b", temp.val[0], temp.val[1], temp.val[2],
+                    ds->color.c[0], ds->color.c[1], ds->color.c[2]);
+    if (draw_sink != NULL) {
+        draw_sink->point(draw_sink, &temp, ds->color);
+        return;
+    }
     point_draw(&temp, src, ds->color);
-    printf("color: %f, %f, %f\n", ds->color.c[0], ds->color.c[1], ds->color.c[2]);
 }
 
-
-// Helper function to apply transformations and draw a line
-void draw_transformed_line(Line *l, Matrix *VTM, Matrix *GTM, Matrix *LTM, DrawState *ds, Image *src) {
+// Helper function to draw a line through the composite matrix
+void draw_composite_line(Line *l, Matrix *CTM, const ClipVolume *clip, DrawState *ds, Image *src) {
     Line temp;
     line_copy(&temp, l);
-    printf("Before LTM: %f, %f, %f, %f\n", temp.a.val[0], temp.a.val[1], temp.a.val[2], temp.a.val[3]);
-    matrix_xformPoint(LTM, &temp.a, &temp.a);
-    matrix_xformPoint(LTM, &temp.b, &temp.b);
-    printf("After LTM: %f, %f, %f, %f\n", temp.a.val[0], temp.a.val[1], temp.a.val[2], temp.a.val[3]);
-    matrix_xformPoint(GTM, &temp.a, &temp.a);
-    matrix_xformPoint(GTM, &temp.b, &temp.b);
-    printf("After GTM: %f, %f, %f, %f\n", temp.a.val[0], temp.a.val[1], temp.a.val[2], temp.a.val[3]);
-    matrix_xformPoint(VTM, &temp.a, &temp.a);
-    matrix_xformPoint(VTM, &temp.b, &temp.b);
-    printf("After VTM: %f, %f, %f, %f\n", temp.a.val[0], temp.a.val[1], temp.a.val[2], temp.a.val[3]);
+    temp.zBuffer = l->zBuffer && ds->zBufferFlag;
+    matrix_xformPoint(CTM, &l->a, &temp.a);
+    matrix_xformPoint(CTM, &l->b, &temp.b);
+    draw_stats.vertexTransforms += 2;
+    if ((clip_outcode(clip, &temp.a) | clip_outcode(clip, &temp.b)) != 0) {
+        draw_stats.clippedPrimitives++;
+        if (!clip_line(clip, &temp.a, &temp.b)) {
+            return;
+        }
+    }
     point_normalize(&temp.a);
     point_normalize(&temp.b);
-    printf("After norm: %f, %f, %f, %f\n", temp.a.val[0], temp.a.val[1], temp.a.val[2], temp.a.val[3]);
+    TRACE_PRIMITIVE("draw line", "x0,y0,z0,x1,y1,z1", temp.a.val[0], temp.a.val[1], temp.a.val[2],
+                    temp.b.val[0], temp.b.val[1], temp.b.val[2]);
+    if (draw_sink != NULL) {
+        draw_sink->line(draw_sink, &temp, ds->color);
+        return;
+    }
     line_draw(&temp, src, ds->color);
 }
 
-// Helper function to apply transformations and draw a polyline
-void draw_transformed_polyline(Polyline *p, Matrix *VTM, Matrix *GTM, Matrix *LTM, DrawState *ds, Image *src) {
+// Helper function to draw a polyline through the composite matrix
+void draw_composite_polyline(Polyline *p, Matrix *CTM, const ClipVolume *clip, DrawState *ds, Image *src) {
     Polyline temp;
-    polyline_copy(&temp, p);
-    matrix_xformPolyline(LTM, &temp);
-    matrix_xformPolyline(GTM, &temp);
-    matrix_xformPolyline(VTM, &temp);
-    polyline_draw(&temp, src, ds->color);
+    temp.zBuffer = p->zBuffer && ds->zBufferFlag;
+    temp.numVertex = p->vertex != NULL ? p->numVertex : 0;
+    temp.vertex = draw_scratch_reserve(temp.numVertex);
+    // the transform also copies the vertices into the scratch buffer
+    matrix_xformPoints(CTM, p->vertex, temp.vertex, temp.numVertex, 0);
+    draw_stats.vertexTransforms += temp.numVertex;
+
+    int codeOr = 0;
+    for (int i = 0; i < temp.numVertex; i++) {
+        codeOr |= clip_outcode(clip, &temp.vertex[i]);
+    }
+    if (codeOr == 0) {
+        for (int i = 0; i < temp.numVertex; i++) {
+            point_normalize(&temp.vertex[i]);
+        }
+        if (draw_sink != NULL) {
+            // the same segments polyline_draw would draw
+            for (int i = 0; i < temp.numVertex - 1; i++) {
+                Line l;
+                line_set(&l, temp.vertex[i], temp.vertex[i + 1]);
+                line_zBuffer(&l, temp.zBuffer);
+                draw_sink->line(draw_sink, &l, ds->color);
+            }
+            return;
+        }
+        polyline_draw(&temp, src, ds->color);
+        return;
+    }
+
+    // clip each segment on its own
+    draw_stats.clippedPrimitives++;
+    for (int i = 0; i < temp.numVertex - 1; i++) {
+        Point a = temp.vertex[i], b = temp.vertex[i + 1];
+        if (clip_line(clip, &a, &b)) {
+            point_normalize(&a);
+            point_normalize(&b);
+            draw_segment(&a, &b, temp.zBuffer, ds, src);
+        }
+    }
 }
 
-// Helper function to apply transformations and draw a polygon
-void draw_transformed_polygon(Polygon *p, Matrix *VTM, Matrix *GTM, Matrix *LTM, DrawState *ds, Image *src) {
+// Helper function to draw a polygon through the composite matrix
+void draw_composite_polygon(Polygon *p, Matrix *CTM, const ClipVolume *clip, DrawState *ds, Image *src) {
     Polygon temp;
-    polygon_copy(&temp, p);
-    matrix_xformPolygon(LTM, &temp);
-    matrix_xformPolygon(GTM, &temp);
-    matrix_xformPolygon(VTM, &temp);
-    polygon_draw(&temp, src, ds->color);
+    temp.oneSided = p->oneSided;
+    temp.zBuffer = p->zBuffer && ds->zBufferFlag;
+    temp.nVertex = p->vertex != NULL ? p->nVertex : 0;
+    temp.vertex = draw_scratch_reserve(temp.nVertex);
+    // the transform also copies the vertices into the scratch buffer
+    matrix_xformPoints(CTM, p->vertex, temp.vertex, temp.nVertex, 0);
+    draw_stats.vertexTransforms += temp.nVertex;
+
+    int codeOr = 0, codeAnd = ~0;
+    for (int i = 0; i < temp.nVertex; i++) {
+        int code = clip_outcode(clip, &temp.vertex[i]);
+        codeOr |= code;
+        codeAnd &= code;
+    }
+    if (temp.nVertex > 0 && codeAnd != 0) {
+        // every vertex is outside the same plane
+        draw_stats.clippedPrimitives++;
+        return;
+    }
+
+    if (codeOr == 0) {
+        for (int i = 0; i < temp.nVertex; i++) {
+            point_normalize(&temp.vertex[i]);
+        }
+        if (draw_sink != NULL) {
+            // the same closed outline polygon_draw would draw
+            if (temp.nVertex >= 2) {
+                Line l;
+                for (int i = 0; i < temp.nVertex - 1; i++) {
+                    line_set(&l, temp.vertex[i], temp.vertex[i + 1]);
+                    line_zBuffer(&l, temp.zBuffer);
+                    draw_sink->line(draw_sink, &l, ds->color);
+                }
+                line_set(&l, temp.vertex[temp.nVertex - 1], temp.vertex[0]);
+                line_zBuffer(&l, temp.zBuffer);
+                draw_sink->line(draw_sink, &l, ds->color);
+            }
+            return;
+        }
+        polygon_draw(&temp, src, ds->color);
+        return;
+    }
+
+    // outline the clipped polygon, leaving out the edges the planes made
+    Point* vertex;
+    unsigned char* edge;
+    long allocations = draw_clip_scratch.allocations;
+    int n = clip_polygon(clip, temp.vertex, temp.nVertex, &draw_clip_scratch, &vertex, &edge);
+    draw_stats.allocations += draw_clip_scratch.allocations - allocations;
+    draw_stats.clippedPrimitives++;
+    for (int i = 0; i < n; i++) {
+        point_normalize(&vertex[i]);
+    }
+    for (int i = 0; i < n && n >= 2; i++) {
+        if (edge[i]) {
+            draw_segment(&vertex[i], &vertex[(i + 1) % n], temp.zBuffer, ds, src);
+        }
+    }
+}
+
+// CTM = VTM * GTM * LTM and the clip volume for the draw_transformed
+// functions.
+static void draw_transformed_setup(Matrix *VTM, Matrix *GTM, Matrix *LTM, Image *src,
+                                   Matrix *CTM, ClipVolume *clip) {
+    draw_compose(VTM, GTM, CTM);
+    matrix_multiply(CTM, LTM, CTM);
+    clip_volume(clip, VTM, src->rows, src->cols);
+}
+
+void draw_transformed_point(Point *p, Matrix *VTM, Matrix *GTM, Matrix *LTM, DrawState *ds, Image *src) {
+    Matrix CTM;
+    ClipVolume clip;
+    draw_transformed_setup(VTM, GTM, LTM, src, &CTM, &clip);
+    draw_composite_point(p, &CTM, &clip, ds, src);
+}
+
+void draw_transformed_line(Line *l, Matrix *VTM, Matrix *GTM, Matrix *LTM, DrawState *ds, Image *src) {
+    Matrix CTM;
+    ClipVolume clip;
+    draw_transformed_setup(VTM, GTM, LTM, src, &CTM, &clip);
+    draw_composite_line(l, &CTM, &clip, ds, src);
+}
+
+void draw_transformed_polyline(Polyline *p, Matrix *VTM, Matrix *GTM, Matrix *LTM, DrawState *ds, Image *src) {
+    Matrix CTM;
+    ClipVolume clip;
+    draw_transformed_setup(VTM, GTM, LTM, src, &CTM, &clip);
+    draw_composite_polyline(p, &CTM, &clip, ds, src);
+}
+
+void draw_transformed_polygon(Polygon *p, Matrix *VTM, Matrix *GTM, Matrix *LTM, DrawState *ds, Image *src) {
+    Matrix CTM;
+    ClipVolume clip;
+    draw_transformed_setup(VTM, GTM, LTM, src, &CTM, &clip);
+    draw_composite_polygon(p, &CTM, &clip, ds, src);
+}
+
+// Saved traversal state of a module whose submodule is being drawn.
+typedef struct {
+    Element* next;  // element to resume at when the submodule is done
+    Matrix LTM;
+    Matrix VGTM;    // VTM * GTM of the module
+    Matrix CTM;     // VGTM * LTM
+    DrawState ds;
+} DrawFrame;
+
+// Traversal stack shared by every draw. Like the scratch buffer it only grows,
+// so it is allocated once for the deepest hierarchy that has been drawn.
+static DrawFrame* draw_stack = NULL;
+static int draw_stack_size = 0;
+
+// Return a stack with room for at least depth + 1 frames.
+static DrawFrame* draw_stack_reserve(int depth) {
+    if (depth >= draw_stack_size) {
+        int size = draw_stack_size > 0 ? draw_stack_size * 2 : 32;
+        while (size <= depth) {
+            size *= 2;
+        }
+        DrawFrame* stack = (DrawFrame*)realloc(draw_stack, sizeof(DrawFrame) * size);
+        if (stack == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        draw_stack = stack;
+        draw_stack_size = size;
+        draw_stats.allocations++;
+    }
+    return draw_stack;
+}
+
+// Return non-zero if nothing inside the box b, taken to the screen by the
+// composite VGTM = VTM * GTM, can be inside clip: all eight corners are
+// outside the same plane. The test is done before the divide by h, so it
+// holds for boxes that reach behind the eye as well.
+static int bounds_outside(Bounds* b, Matrix* VGTM, const ClipVolume* clip) {
+    int outside = ~0;
+
+    if (b->empty) {
+        return 1;
+    }
+
+    for (int i = 0; i < 8 && outside != 0; i++) {
+        Point p, q;
+        bounds_corner(b, i, &p);
+        matrix_xformPoint(VGTM, &p, &q);
+        outside &= clip_outcode(clip, &q);
+    }
+    return outside != 0;
+}
+
+// Depth pyramid of the image module_draw is drawing into. Like the other
+// scratch buffers it only grows.
+static DepthPyramid draw_pyramid;
+
+// Relative amount by which the nearest 1/z of a box is raised before it is
+// compared with the pyramid, to cover the rounding of the 1/z values the
+// rasterizers interpolate.
+#define DRAW_OCCLUSION_SLACK 1e-4
+
+// Return non-zero if nothing inside the box b, taken to the screen by the
+// composite VGTM = VTM * GTM, could pass the depth test of src: the
+// primitives in the box are all depth-tested, and every pixel of the screen
+// rectangle around the projected corners already holds a surface closer than
+// the nearest corner. Boxes reaching behind the eye are never hidden.
+static int bounds_hidden(Bounds* b, Matrix* VGTM, DrawState* ds, Image* src) {
+    double xmin = 0.0, xmax = 0.0, ymin = 0.0, ymax = 0.0, nearest = 0.0;
+
+    if (src->hiz == NULL || !ds->zBufferFlag || b->empty || !b->depthTested) {
+        return 0;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        Point p, q;
+        bounds_corner(b, i, &p);
+        matrix_xformPoint(VGTM, &p, &q);
+        if (q.val[3] < CLIP_NEAR_H || q.val[2] <= 0.0) {
+            return 0;
+        }
+        double x = q.val[0] / q.val[3], y = q.val[1] / q.val[3];
+        if (i == 0 || x < xmin) xmin = x;
+        if (i == 0 || x > xmax) xmax = x;
+        if (i == 0 || y < ymin) ymin = y;
+        if (i == 0 || y > ymax) ymax = y;
+        if (1.0 / q.val[2] > nearest) nearest = 1.0 / q.val[2];
+    }
+
+    // the pixels the rasterizers could touch, with one to spare on each side
+    // for rounding; boxes off the image are left to the clip volume
+    xmin = floor(xmin) - 1.0;
+    ymin = floor(ymin) - 1.0;
+    xmax = floor(xmax) + 1.0;
+    ymax = floor(ymax) + 1.0;
+    if (xmax < 0.0 || ymax < 0.0 || xmin >= src->cols || ymin >= src->rows) {
+        return 0;
+    }
+    int x0 = xmin > 0.0 ? (int)xmin : 0;
+    int y0 = ymin > 0.0 ? (int)ymin : 0;
+    int x1 = xmax < src->cols - 1 ? (int)xmax : src->cols - 1;
+    int y1 = ymax < src->rows - 1 ? (int)ymax : src->rows - 1;
+    return depthpyramid_hidden(src->hiz, src, x0, y0, x1, y1,
+                               (float)(nearest * (1.0 + DRAW_OCCLUSION_SLACK)));
+}
+
+// VTM * GTM of the instances being drawn. Grows like the scratch vertex buffer.
+static Matrix* draw_instance_vgtm = NULL;
+static int draw_instance_size = 0;
+
+// Draw every instance of inst whose bounds reach the image. CTM is the
+// composite in effect at the instances element. The composite of each instance
+// is computed in one pass, then the prototype, flattened once into a command
+// buffer, is replayed for each instance that survives culling.
+static void draw_instances(Instances* inst, Matrix* CTM, const ClipVolume* clip,
+                           DrawState* ds, Lighting* lighting, Image* src) {
+    if (inst->n == 0 || inst->proto->head == NULL) {
+        return;
+    }
+    if (inst->n > draw_instance_size) {
+        int size = draw_instance_size > 0 ? draw_instance_size : 16;
+        while (size < inst->n) {
+            size *= 2;
+        }
+        Matrix* vgtm = (Matrix*)realloc(draw_instance_vgtm, sizeof(Matrix) * size);
+        if (vgtm == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        draw_instance_vgtm = vgtm;
+        draw_instance_size = size;
+        draw_stats.allocations++;
+    }
+    // the prototype or a module below it changed since it was flattened;
+    // edits elsewhere in the scene leave the buffer alone
+    module_bounds(inst->proto);
+    if (inst->compiled == NULL || inst->compiledEpoch != inst->proto->changeEpoch) {
+        compiled_module_free(inst->compiled);
+        inst->compiled = module_compile(inst->proto);
+        inst->compiledEpoch = inst->proto->changeEpoch;
+        draw_stats.allocations++;
+    }
+
+    for (int i = 0; i < inst->n; i++) {
+        draw_compose(CTM, &inst->xforms[i], &draw_instance_vgtm[i]);
+    }
+
+    for (int i = 0; i < inst->n; i++) {
+        if (bounds_outside(&inst->proto->bounds, &draw_instance_vgtm[i], clip)) {
+            if (!inst->proto->bounds.empty) {
+                draw_stats.culledInstances++;
+            }
+            continue;
+        }
+        if (bounds_hidden(&inst->proto->bounds, &draw_instance_vgtm[i], ds, src)) {
+            draw_stats.occludedInstances++;
+            continue;
+        }
+        // like a submodule, each instance works on its own copy of the DrawState
+        DrawState saved = *ds;
+        compiled_module_drawComposite(inst->compiled, &draw_instance_vgtm[i], clip, ds,
+                                      lighting, src);
+        *ds = saved;
+    }
 }
 
 // Draw the module into the image using the given view transformation matrix
 // [VTM], Lighting and DrawState by traversing the list of Elements. (For now,
 // Lighting can be an empty structure.)
+//
+// The hierarchy is walked without recursion. Entering a submodule pushes the
+// current element, LTM, VTM * GTM, composite and DrawState onto draw_stack;
+// the submodule then runs with the current composite VTM * GTM * LTM as its
+// VTM * GTM, an identity LTM and a copy of the DrawState, and the saved frame
+// is restored when its element list runs out. The composite is rebuilt only
+// when a primitive needs it after LTM or the module changed.
 void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds,
                  Lighting *lighting, Image *src) {
     
@@ -416,31 +1089,88 @@ void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds,
         return;
     }
 
+    TRACE_FRAME_BEGIN("module_draw");
+
+    // bring the bounds of every module below md up to date for culling
+    module_bounds(md);
+
+    ClipVolume clip;
+    clip_volume(&clip, VTM, src->rows, src->cols);
+
+    // keep a depth pyramid of src for occlusion tests; it starts from the
+    // depth buffer as it is, so whatever was drawn before can hide submodules
+    int occlusion = draw_sink == NULL && ds->zBufferFlag && VTM->kind == MatrixProjective &&
+                    image_hasDepth(src);
+    if (occlusion) {
+        long allocations = draw_pyramid.allocations;
+        depthpyramid_reset(&draw_pyramid, src);
+        draw_stats.allocations += draw_pyramid.allocations - allocations;
+        src->hiz = &draw_pyramid;
+    }
+
     Element* current = md->head;
-    Matrix LTM, GTMpass;
+    Matrix LTM, VGTM, CTM;
+    int ctmValid = 1;
+    int depth = 0;
     matrix_identity(&LTM);  // Initialize LTM to the identity matrix
-    
-    while (current != NULL) {
+    draw_compose(VTM, GTM, &VGTM);
+    matrix_copy(&CTM, &VGTM);
+
+    while (1) {
+        // finished a submodule, resume its parent
+        if (current == NULL) {
+            if (depth == 0) {
+                break;
+            }
+            DrawFrame* frame = &draw_stack[--depth];
+            current = frame->next;
+            matrix_copy(&LTM, &frame->LTM);
+            matrix_copy(&VGTM, &frame->VGTM);
+            matrix_copy(&CTM, &frame->CTM);
+            ctmValid = 1;
+            *ds = frame->ds;
+            continue;
+        }
+
+        // everything but the attribute elements needs the composite
+        switch (current->type) {
+            case ObjLine:
+            case ObjPoint:
+            case ObjPolyline:
+            case ObjPolygon:
+            case ObjModule:
+            case ObjInstances:
+                if (!ctmValid) {
+                    draw_compose(&VGTM, &LTM, &CTM); // CTM = VTM * GTM * LTM
+                    ctmValid = 1;
+                }
+                break;
+            default:
+                break;
+        }
+
         switch (current->type) {
             case ObjNone:
                 break;
             case ObjLine:
-                draw_transformed_line((Line*)current->obj, VTM, GTM, &LTM, ds, src);                
+                draw_composite_line((Line*)current->obj, &CTM, &clip, ds, src);
                 break;
             case ObjPoint:
-                draw_transformed_point((Point*)current->obj, VTM, GTM, &LTM, ds, src);
+                draw_composite_point((Point*)current->obj, &CTM, &clip, ds, src);
                 break;
             case ObjPolyline:
-                draw_transformed_polyline((Polyline*)current->obj, VTM, GTM, &LTM, ds, src);
+                draw_composite_polyline((Polyline*)current->obj, &CTM, &clip, ds, src);
                 break;
             case ObjPolygon:
-                draw_transformed_polygon((Polygon*)current->obj, VTM, GTM, &LTM, ds, src);
+                draw_composite_polygon((Polygon*)current->obj, &CTM, &clip, ds, src);
                 break;
             case ObjIdentity:
                 matrix_identity(&LTM);
+                ctmValid = 0;
                 break;
             case ObjMatrix:
                 matrix_multiply((Matrix*)current->obj, &LTM, &LTM); // LTM = current->obj * LTM
+                ctmValid = 0;
                 break;
             case ObjColor:
                 ds->color = *((Color*)current->obj);
@@ -456,16 +1186,34 @@ void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds,
                 break;
             // case ObjLight:
             //     break;
-            case ObjModule:
-                matrix_multiply(GTM, &LTM, &GTMpass);  // GTMpass = GTM * LTM
-                DrawState* ds_copy = (DrawState*)malloc(sizeof(DrawState));
-                if (ds_copy == NULL) {
-                    fprintf(stderr, "Memory allocation failed\n");
-                    exit(EXIT_FAILURE);
+            case ObjModule: {
+                // the submodule's VTM * GTM is the current composite
+                Module* sub = (Module*)current->obj;
+                if (bounds_outside(&sub->bounds, &CTM, &clip)) {
+                    if (!sub->bounds.empty) {
+                        draw_stats.culledModules++;
+                    }
+                    break;
                 }
-                memcpy(ds_copy, ds, sizeof(DrawState));
-                module_draw((Module*)current->obj, VTM, &GTMpass, ds_copy, NULL, src);
-                free(ds_copy);
+                if (bounds_hidden(&sub->bounds, &CTM, ds, src)) {
+                    draw_stats.occludedModules++;
+                    break;
+                }
+
+                DrawFrame* frame = &draw_stack_reserve(depth)[depth];
+                depth++;
+                frame->next = current->next;
+                matrix_copy(&frame->LTM, &LTM);
+                matrix_copy(&frame->VGTM, &VGTM);
+                matrix_copy(&frame->CTM, &CTM);
+                frame->ds = *ds;
+                matrix_copy(&VGTM, &CTM);
+                matrix_identity(&LTM);
+                current = sub->head;
+                continue;
+            }
+            case ObjInstances:
+                draw_instances((Instances*)current->obj, &CTM, &clip, ds, lighting, src);
                 break;
             default:
                 fprintf(stderr, "Invalid object type\n");
@@ -473,66 +1221,64 @@ void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds,
         }
         current = current->next;
     }
+
+    if (occlusion) {
+        src->hiz = NULL;
+    }
+
+    TRACE_FRAME_END("module_draw");
+}
+
+void module_drawSink(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds,
+                     Lighting *lighting, Image *src, DrawSink *sink) {
+    draw_sink = sink;
+    module_draw(md, VTM, GTM, ds, lighting, src);
+    draw_sink = NULL;
 }
 
 // Matrix operand to add a 3D translation to the Module
 void module_translate(Module *md, double tx, double ty, double tz) {
-    Matrix* m = (Matrix*)malloc(sizeof(Matrix));
+    Matrix* m = (Matrix*)module_alloc(md, sizeof(Matrix));
     matrix_identity(m);
     matrix_translate(m, tx, ty, tz);
 
-    Element* new_element = element_create();
-    new_element->type = ObjMatrix;
-    new_element->obj = m;
-    module_insert(md, new_element);
+    module_append(md, ObjMatrix, m);
 }
 
 // Matrix operand to add a 3D scale to the Module
 void module_scale(Module *md, double sx, double sy, double sz) {
-    Matrix* m = (Matrix*)malloc(sizeof(Matrix));
+    Matrix* m = (Matrix*)module_alloc(md, sizeof(Matrix));
     matrix_identity(m);
     matrix_scale(m, sx, sy, sz);
 
-    Element* new_element = element_create();
-    new_element->type = ObjMatrix;
-    new_element->obj = m;
-    module_insert(md, new_element);
+    module_append(md, ObjMatrix, m);
 }
 
 // Matrix operand to add a rotation about the X-axis to the Module
 void module_rotateX(Module *md, double cth, double sth) {
-    Matrix* m = (Matrix*)malloc(sizeof(Matrix));
+    Matrix* m = (Matrix*)module_alloc(md, sizeof(Matrix));
     matrix_identity(m);
     matrix_rotateX(m, cth, sth);
 
-    Element* new_element = element_create();
-    new_element->type = ObjMatrix;
-    new_element->obj = m;
-    module_insert(md, new_element);
+    module_append(md, ObjMatrix, m);
 }
 
 // Matrix operand to add a rotation about the Y-axis to the Module
 void module_rotateY(Module *md, double cth, double sth) {
-    Matrix* m = (Matrix*)malloc(sizeof(Matrix));
+    Matrix* m = (Matrix*)module_alloc(md, sizeof(Matrix));
     matrix_identity(m);
     matrix_rotateY(m, cth, sth);
 
-    Element* new_element = element_create();
-    new_element->type = ObjMatrix;
-    new_element->obj = m;
-    module_insert(md, new_element);
+    module_append(md, ObjMatrix, m);
 }
 
 // Matrix operand to add a rotation that orients to the orthonormal axes u, v, w
 void module_rotateXYZ(Module *md, Vector *u, Vector *v, Vector *w) {
-    Matrix* m = (Matrix*)malloc(sizeof(Matrix));
+    Matrix* m = (Matrix*)module_alloc(md, sizeof(Matrix));
     matrix_identity(m);
     matrix_rotateXYZ(m, u, v, w);
 
-    Element* new_element = element_create();
-    new_element->type = ObjMatrix;
-    new_element->obj = m;
-    module_insert(md, new_element);
+    module_append(md, ObjMatrix, m);
 }
 
 //  Adds a unit cube, axis-aligned and centered on zero to the Module. If solid
@@ -555,6 +1301,9 @@ void module_cube(Module *md, int solid) {
 
     // Define the 6 faces of the cube
     Point temp[4];
+    for (int i = 0; i < 6; i++) {
+        polygon_init(&p[i]);
+    }
     point_copy(&temp[0], &pt[0]);
     point_copy(&temp[1], &pt[1]);
     point_copy(&temp[2], &pt[2]);
@@ -601,49 +1350,28 @@ void module_cube(Module *md, int solid) {
             module_line(md, &l3);
             module_line(md, &l4);
         }
+        polygon_clear(&p[i]);
     }
 }
 
 // Adds the foreground color value to the tail of the module’s list.
 void module_color(Module *md, Color *c) {
-    Color* c_copy = duplicate_color(c);
-    Element* new_element = element_create();
-    new_element->type = ObjColor;
-    new_element->obj = c_copy;
-    module_insert(md, new_element);
+    module_append(md, ObjColor, module_copy(md, c, sizeof(Color)));
 }
 
 // Adds the body color value to the tail of the module’s list.
 void module_bodyColor(Module *md, Color *c) {
-    Color* c_copy = duplicate_color(c);
-    Element* new_element = element_create();
-    new_element->type = ObjBodyColor;
-    new_element->obj = c_copy;
-    module_insert(md, new_element);
+    module_append(md, ObjBodyColor, module_copy(md, c, sizeof(Color)));
 }
 
 // Adds the surface color value to the tail of the module’s list.
 void module_surfaceColor(Module *md, Color *c) {
-    Color* c_copy = duplicate_color(c);
-    Element* new_element = element_create();
-    new_element->type = ObjSurfaceColor;
-    new_element->obj = c_copy;
-    module_insert(md, new_element);
+    module_append(md, ObjSurfaceColor, module_copy(md, c, sizeof(Color)));
 }
 
 // Adds the surface coefficient value to the tail of the module’s list.
 void module_surfaceCoeff(Module *md, float coeff) {
-    float* coeff_copy = (float*)malloc(sizeof(float));
-    if (coeff_copy == NULL) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(EXIT_FAILURE);
-    }
-    memcpy(coeff_copy, &coeff, sizeof(float));
-
-    Element* new_element = element_create();
-    new_element->type = ObjSurfaceCoeff;
-    new_element->obj = coeff_copy;
-    module_insert(md, new_element);
+    module_append(md, ObjSurfaceCoeff, module_copy(md, &coeff, sizeof(float)));
 }
 
 // create a new DrawState structure and initialize the fields.
@@ -653,6 +1381,12 @@ DrawState* drawstate_create() {
         fprintf(stderr, "Memory allocation failed\n");
         exit(EXIT_FAILURE);
     }
+    drawstate_init(new_drawstate);
+    return new_drawstate;
+}
+
+// set the fields of an existing DrawState to their defaults.
+void drawstate_init(DrawState *new_drawstate) {
     new_drawstate->zBufferFlag = 1;
     new_drawstate->body = (Color){{0.0, 0.0, 0.0}};
     new_drawstate->surface = (Color){{0.0, 0.0, 0.0}};
@@ -664,7 +1398,6 @@ DrawState* drawstate_create() {
     new_drawstate->viewer.val[0] = 0.0;
     new_drawstate->viewer.val[1] = 0.0;
     new_drawstate->viewer.val[2] = -1.0;
-    return new_drawstate;
 }
 
 void drawstate_setColor(DrawState *ds, Color c) {
@@ -1,8 +1,21 @@
 #include "../include/image.h"
+#include "../include/depth_pyramid.h"
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// The fills store whole runs of pixels, and image_write converts whole runs of
+// a plane, with AVX or SSE2 when the compiler targets them, unless
+// TRANSFORM_SCALAR is defined.
+#if !defined(TRANSFORM_SCALAR) && defined(__AVX__)
+#define IMAGE_AVX
+#include <immintrin.h>
+#elif !defined(TRANSFORM_SCALAR) && defined(__SSE2__)
+#define IMAGE_SSE2
+#include <emmintrin.h>
+#endif
+
 Image *image_create(int rows, int cols) {
   Image *img = (Image *)malloc(sizeof(Image));
   if (!img)
@@ -29,10 +42,217 @@ void image_init(Image *src) {
     src->rows = 0;
     src->cols = 0;
     src->data = NULL;
+    src->pixels = NULL;
+    src->rgb[0] = src->rgb[1] = src->rgb[2] = NULL;
+    src->stride = 0;
+    src->layout = ImageInterleaved;
+    src->rgba = NULL;
+    src->depth16 = NULL;
+    src->depth24 = NULL;
+    src->depthBits = 24;
+    src->cleared = NULL;
+    src->tileRows = 0;
+    src->tileCols = 0;
     src->depth = NULL;
     src->alpha = NULL;
     src->maxval = 255.0f;
     src->filename = NULL;
+    src->hiz = NULL;
+  }
+}
+
+// Pixel every image starts from and image_reset goes back to.
+static const FPixel image_clear = {{0.0f, 0.0f, 0.0f}, 1.0f, IMAGE_Z_CLEAR};
+
+// Set the n pixels from pixel on to val.
+static void image_fillPixels(FPixel *pixel, long n, FPixel val) {
+#if defined(IMAGE_AVX) || defined(IMAGE_SSE2)
+  // FPixel is five floats, so eight pixels (four with SSE2) are five whole
+  // vectors of the pixel repeated
+  float pattern[40];
+  for (int i = 0; i < 40; i += 5) {
+    memcpy(&pattern[i], &val, sizeof(FPixel));
+  }
+  float *out = (float *)pixel;
+#if defined(IMAGE_AVX)
+  __m256 v[5];
+  for (int k = 0; k < 5; k++)
+    v[k] = _mm256_loadu_ps(&pattern[8 * k]);
+  for (; n >= 8; n -= 8, out += 40) {
+    for (int k = 0; k < 5; k++)
+      _mm256_storeu_ps(out + 8 * k, v[k]);
+  }
+#else
+  __m128 v[5];
+  for (int k = 0; k < 5; k++)
+    v[k] = _mm_loadu_ps(&pattern[4 * k]);
+  for (; n >= 4; n -= 4, out += 20) {
+    for (int k = 0; k < 5; k++)
+      _mm_storeu_ps(out + 4 * k, v[k]);
+  }
+#endif
+  pixel = (FPixel *)out;
+#endif
+  for (long i = 0; i < n; i++)
+    pixel[i] = val;
+}
+
+// Set the n floats from out on to v.
+static void image_fillFloats(float *out, long n, float v) {
+#if defined(IMAGE_AVX)
+  __m256 v8 = _mm256_set1_ps(v);
+  for (; n >= 8; n -= 8, out += 8)
+    _mm256_storeu_ps(out, v8);
+#elif defined(IMAGE_SSE2)
+  __m128 v4 = _mm_set1_ps(v);
+  for (; n >= 4; n -= 4, out += 4)
+    _mm_storeu_ps(out, v4);
+#endif
+  for (long i = 0; i < n; i++)
+    out[i] = v;
+}
+
+// Set the n pixels of a planar image from index i on to val, one plane at a
+// time.
+static void image_fillPlanes(Image *src, size_t i, long n, FPixel val) {
+  for (int b = 0; b < 3; b++)
+    image_fillFloats(src->rgb[b] + i, n, val.rgb[b]);
+  image_fillFloats(src->alpha + i, n, val.a);
+  image_fillFloats(src->depth + i, n, val.z);
+}
+
+// Convert the n channel values from in to bytes the way image_write always
+// has, value * 255 truncated to an int and cut to its low byte.
+static void image_toBytes(const float *in, unsigned char *out, int n) {
+  int i = 0;
+#if defined(IMAGE_AVX) || defined(IMAGE_SSE2)
+  __m128 scale = _mm_set1_ps(255.0f);
+  __m128i low = _mm_set1_epi32(0xff);
+  for (; i + 16 <= n; i += 16) {
+    __m128i q[4];
+    for (int k = 0; k < 4; k++) {
+      __m128 v = _mm_mul_ps(_mm_loadu_ps(in + i + 4 * k), scale);
+      q[k] = _mm_and_si128(_mm_cvttps_epi32(v), low);
+    }
+    // every lane is 0 to 255 by now, so the saturating packs keep it
+    __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]),
+                                     _mm_packs_epi32(q[2], q[3]));
+    _mm_storeu_si128((__m128i *)(out + i), bytes);
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = (unsigned char)(in[i] * 255);
+}
+
+// Index of pixel (r, c) in the planes of a planar or RGBA8 image.
+static inline size_t image_index(const Image *src, int r, int c) {
+  return (size_t)r * src->stride + c;
+}
+
+// Set the n words from out on to v.
+static void image_fillWords(unsigned int *out, long n, unsigned int v) {
+#if defined(IMAGE_AVX)
+  __m256i v8 = _mm256_set1_epi32((int)v);
+  for (; n >= 8; n -= 8, out += 8)
+    _mm256_storeu_si256((__m256i *)out, v8);
+#elif defined(IMAGE_SSE2)
+  __m128i v4 = _mm_set1_epi32((int)v);
+  for (; n >= 4; n -= 4, out += 4)
+    _mm_storeu_si128((__m128i *)out, v4);
+#endif
+  for (long i = 0; i < n; i++)
+    out[i] = v;
+}
+
+// Set the n halfwords from out on to v.
+static void image_fillShorts(unsigned short *out, long n, unsigned short v) {
+#if defined(IMAGE_AVX) || defined(IMAGE_SSE2)
+  __m128i v8 = _mm_set1_epi16((short)v);
+  for (; n >= 8; n -= 8, out += 8)
+    _mm_storeu_si128((__m128i *)out, v8);
+#endif
+  for (long i = 0; i < n; i++)
+    out[i] = v;
+}
+
+// The four bytes an RGBA8 image stores val as, in one word.
+static unsigned int image_packRGBA(FPixel val) {
+  unsigned char bytes[4] = {image_byte(val.rgb[0]), image_byte(val.rgb[1]),
+                            image_byte(val.rgb[2]), image_byte(val.a)};
+  unsigned int word;
+  memcpy(&word, bytes, sizeof(word));
+  return word;
+}
+
+// Set the n pixels of an RGBA8 image from index i on to val.
+static void image_fillRGBA8(Image *src, size_t i, long n, FPixel val) {
+  image_fillWords((unsigned int *)src->rgba + i, n, image_packRGBA(val));
+  if (src->depthBits == 16)
+    image_fillShorts(src->depth16 + i, n, image_depthCode(val.z, 16));
+  else if (src->depthBits == 24)
+    image_fillWords(src->depth24 + i, n, image_depthCode(val.z, 24));
+}
+
+// Store val in the n pixels from index i on, in the layout of src.
+static void image_store(Image *src, size_t i, long n, FPixel val) {
+  if (src->layout == ImagePlanar)
+    image_fillPlanes(src, i, n, val);
+  else if (src->layout == ImageRGBA8)
+    image_fillRGBA8(src, i, n, val);
+  else
+    image_fillPixels(src->pixels + i, n, val);
+}
+
+// What a pixel of src set to val reads back as.
+static FPixel image_stored(const Image *src, FPixel val) {
+  if (src->layout != ImageRGBA8)
+    return val;
+  for (int b = 0; b < 3; b++)
+    val.rgb[b] = image_byte(val.rgb[b]) / 255.0f;
+  val.a = image_byte(val.a) / 255.0f;
+  if (src->depthBits != 0)
+    val.z = image_depthValue(image_depthCode(val.z, src->depthBits),
+                             src->depthBits);
+  else
+    val.z = IMAGE_Z_CLEAR;
+  return val;
+}
+
+// Give src, whose storage is set up, its tile flags, all cleared to the
+// default pixel. On failure the storage is freed as well.
+static int image_allocTiles(Image *src) {
+  int size = 1 << IMAGE_TILE_SHIFT;
+  src->tileRows = (src->rows + size - 1) / size;
+  src->tileCols = (src->cols + size - 1) / size;
+  src->cleared = (unsigned char *)malloc((size_t)src->tileRows * src->tileCols);
+  if (!src->cleared) {
+    image_dealloc(src);
+    return -1;
+  }
+  image_fill(src, image_clear);
+  return 0;
+}
+
+void image_materialize(Image *src, int r, int c) {
+  unsigned char *cleared = &src->cleared[(r >> IMAGE_TILE_SHIFT) * src->tileCols +
+                                         (c >> IMAGE_TILE_SHIFT)];
+  if (!*cleared)
+    return;
+
+  int size = 1 << IMAGE_TILE_SHIFT;
+  int r0 = r & ~(size - 1), c0 = c & ~(size - 1);
+  int r1 = r0 + size < src->rows ? r0 + size : src->rows;
+  int n = c0 + size < src->cols ? size : src->cols - c0;
+  for (int row = r0; row < r1; row++)
+    image_store(src, image_index(src, row, c0), n, src->clearValue);
+  *cleared = 0;
+}
+
+void image_prepareSpan(Image *src, int row, int c0, int c1) {
+  unsigned char *cleared = &src->cleared[(row >> IMAGE_TILE_SHIFT) * src->tileCols];
+  for (int t = c0 >> IMAGE_TILE_SHIFT; t <= c1 >> IMAGE_TILE_SHIFT; t++) {
+    if (cleared[t])
+      image_materialize(src, row, t << IMAGE_TILE_SHIFT);
   }
 }
 
@@ -41,43 +261,96 @@ int image_alloc(Image *src, int rows, int cols) {
     return -1;
 
   image_dealloc(src); // in case the image already has data
-  src->rows = rows;
-  src->cols = cols;
-  src->data = (FPixel **)malloc(rows * sizeof(FPixel *));
-  if (!src->data)
-    return -1;
 
-  for (int i = 0; i < rows; i++) {
-    src->data[i] = (FPixel *)malloc(cols * sizeof(FPixel));
-    if (!src->data[i]) {
-      for (int j = 0; j < i; j++)
-        free(src->data[j]);
-      free(src->data);
-      src->data = NULL;
+  if (src->layout == ImagePlanar) {
+    // pad the rows of each plane so that each one starts on an IMAGE_ALIGN
+    // boundary
+    int stride = cols;
+    while ((stride * sizeof(float)) % IMAGE_ALIGN != 0)
+      stride++;
+    size_t plane = (size_t)rows * stride;
+
+    float *block = (float *)aligned_alloc(IMAGE_ALIGN, 5 * plane * sizeof(float));
+    if (!block)
       return -1;
-    }
+    src->rows = rows;
+    src->cols = cols;
+    src->stride = stride;
+    for (int b = 0; b < 3; b++)
+      src->rgb[b] = block + b * plane;
+    src->alpha = block + 3 * plane;
+    src->depth = block + 4 * plane;
+
+    return image_allocTiles(src);
   }
 
-  for (int i = 0; i < rows; i++) {
-    for (int j = 0; j < cols; j++) {
-      src->data[i][j].rgb[0] = 0.0f;
-      src->data[i][j].rgb[1] = 0.0f;
-      src->data[i][j].rgb[2] = 0.0f;
-      src->data[i][j].a = 1.0f;
-      src->data[i][j].z = 1.0f;
-    }
+  if (src->layout == ImageRGBA8) {
+    // pad the rows of both planes so that each one starts on an IMAGE_ALIGN
+    // boundary
+    size_t zbytes = src->depthBits == 16 ? 2 : src->depthBits == 24 ? 4 : 0;
+    int stride = cols;
+    while ((stride * 4) % IMAGE_ALIGN != 0 ||
+           (stride * zbytes) % IMAGE_ALIGN != 0)
+      stride++;
+    size_t plane = (size_t)rows * stride;
+
+    unsigned char *block =
+        (unsigned char *)aligned_alloc(IMAGE_ALIGN, plane * (4 + zbytes));
+    if (!block)
+      return -1;
+    src->rows = rows;
+    src->cols = cols;
+    src->stride = stride;
+    src->rgba = block;
+    if (src->depthBits == 16)
+      src->depth16 = (unsigned short *)(block + 4 * plane);
+    else if (src->depthBits == 24)
+      src->depth24 = (unsigned int *)(block + 4 * plane);
+
+    return image_allocTiles(src);
   }
-  return 0;
+
+  // pad the rows so that each one starts on an IMAGE_ALIGN boundary
+  int stride = cols;
+  while ((stride * sizeof(FPixel)) % IMAGE_ALIGN != 0)
+    stride++;
+  size_t bytes = (size_t)rows * stride * sizeof(FPixel);
+
+  src->data = (FPixel **)malloc(rows * sizeof(FPixel *));
+  src->pixels = (FPixel *)aligned_alloc(IMAGE_ALIGN, bytes);
+  if (!src->data || !src->pixels) {
+    free(src->data);
+    free(src->pixels);
+    src->data = NULL;
+    src->pixels = NULL;
+    return -1;
+  }
+  src->rows = rows;
+  src->cols = cols;
+  src->stride = stride;
+  for (int i = 0; i < rows; i++)
+    src->data[i] = src->pixels + (size_t)i * stride;
+
+  return image_allocTiles(src);
 }
 
 void image_dealloc(Image *src) {
-  if (src && src->data) {
-    for (int i = 0; i < src->rows; i++) {
-      if (src->data[i])
-        free(src->data[i]);
-    }
+  if (src) {
     free(src->data);
+    free(src->pixels);
+    free(src->rgb[0]); // the block of all five planes
+    free(src->rgba);   // the block of the pixels and the depth plane
+    free(src->cleared);
     src->data = NULL;
+    src->pixels = NULL;
+    src->rgb[0] = src->rgb[1] = src->rgb[2] = NULL;
+    src->rgba = NULL;
+    src->depth16 = NULL;
+    src->depth24 = NULL;
+    src->cleared = NULL;
+    src->tileRows = 0;
+    src->tileCols = 0;
+    src->stride = 0;
   }
   src->rows = 0;
   src->cols = 0;
@@ -87,6 +360,36 @@ void image_dealloc(Image *src) {
   src->filename = NULL;
 }
 
+int image_setLayout(Image *src, ImageLayout layout) {
+  if (!src)
+    return -1;
+  if (src->layout == layout)
+    return 0;
+
+  int rows = src->rows, cols = src->cols;
+  image_dealloc(src);
+  src->layout = layout;
+  if (rows > 0 && cols > 0)
+    return image_alloc(src, rows, cols);
+  return 0;
+}
+
+int image_setDepthBits(Image *src, int bits) {
+  if (!src || (bits != 0 && bits != 16 && bits != 24))
+    return -1;
+  if (src->depthBits == bits)
+    return 0;
+
+  src->depthBits = bits;
+  if (src->layout == ImageRGBA8 && src->rows > 0 && src->cols > 0)
+    return image_alloc(src, src->rows, src->cols);
+  return 0;
+}
+
+int image_hasDepth(Image *src) {
+  return src->layout != ImageRGBA8 || src->depthBits != 0;
+}
+
 Image *image_read(char *filename) {
   char tag[40]; // PPM magic number
   Image *img;
@@ -136,19 +439,27 @@ Image *image_read(char *filename) {
     }
 
     img->maxval = (float)colors;
-
-    // Read the data
+    // every pixel is read in below, so no tile needs its clear value
+    memset(img->cleared, 0, (size_t)img->tileRows * img->tileCols);
+
+    // Read the data a row at a time
+    unsigned char *line = (unsigned char *)malloc((size_t)cols * 3);
+    if (!line) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(EXIT_FAILURE);
+    }
     for (int i = 0; i < rows; i++) {
+      FPixel *pixel = img->data[i];
+      fread(line, sizeof(unsigned char), (size_t)cols * 3, fp);
       for (int j = 0; j < cols; j++) {
-        unsigned char rgb[3];
-        fread(rgb, sizeof(unsigned char), 3, fp);
-        img->data[i][j].rgb[0] = rgb[0] / 255.0f;
-        img->data[i][j].rgb[1] = rgb[1] / 255.0f;
-        img->data[i][j].rgb[2] = rgb[2] / 255.0f;
-        img->data[i][j].a = 1.0f; // Default alpha value
-        img->data[i][j].z = 1.0f; // Default depth value
+        pixel[j].rgb[0] = line[3 * j] / 255.0f;
+        pixel[j].rgb[1] = line[3 * j + 1] / 255.0f;
+        pixel[j].rgb[2] = line[3 * j + 2] / 255.0f;
+        pixel[j].a = 1.0f; // Default alpha value
+        pixel[j].z = IMAGE_Z_CLEAR; // Default depth value
       }
     }
+    free(line);
 
     if (fp != stdin)
       fclose(fp);
@@ -158,6 +469,37 @@ Image *image_read(char *filename) {
   return NULL;
 }
 
+// Convert the n pixels of row from column c0 on to the RGB bytes image_write
+// puts out, using band for the scratch space of n * 3 bytes.
+static void image_toRGB(Image *src, int row, int c0, int n, unsigned char *out,
+                        unsigned char *band) {
+  if (src->layout == ImageRGBA8) {
+    // the bytes are already the ones to write; drop the alpha
+    const unsigned char *pixel = src->rgba + 4 * image_index(src, row, c0);
+    for (int j = 0; j < n; j++) {
+      out[3 * j] = pixel[4 * j];
+      out[3 * j + 1] = pixel[4 * j + 1];
+      out[3 * j + 2] = pixel[4 * j + 2];
+    }
+  } else if (src->layout == ImagePlanar) {
+    // convert each plane's run on its own, then interleave the bytes
+    for (int b = 0; b < 3; b++)
+      image_toBytes(src->rgb[b] + image_index(src, row, c0), band + b * n, n);
+    for (int j = 0; j < n; j++) {
+      out[3 * j] = band[j];
+      out[3 * j + 1] = band[n + j];
+      out[3 * j + 2] = band[2 * n + j];
+    }
+  } else {
+    const FPixel *pixel = src->data[row] + c0;
+    for (int j = 0; j < n; j++) {
+      out[3 * j] = (unsigned char)(pixel[j].rgb[0] * 255);
+      out[3 * j + 1] = (unsigned char)(pixel[j].rgb[1] * 255);
+      out[3 * j + 2] = (unsigned char)(pixel[j].rgb[2] * 255);
+    }
+  }
+}
+
 int image_write(Image *src, char *filename) {
   FILE *fp;
 
@@ -171,15 +513,32 @@ int image_write(Image *src, char *filename) {
     fprintf(fp, "P6\n");
     fprintf(fp, "%d %d\n%d\n", src->cols, src->rows, 255);
 
+    // convert and write a row at a time; the pixels of cleared tiles are
+    // the bytes of the clear value
+    int cols = src->cols, size = 1 << IMAGE_TILE_SHIFT;
+    unsigned char clear[3] = {image_byte(src->clearValue.rgb[0]),
+                              image_byte(src->clearValue.rgb[1]),
+                              image_byte(src->clearValue.rgb[2])};
+    unsigned char *line = (unsigned char *)malloc((size_t)cols * 3 + size * 3);
+    if (!line) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(EXIT_FAILURE);
+    }
+    unsigned char *band = line + (size_t)cols * 3;
     for (int i = 0; i < src->rows; i++) {
-      for (int j = 0; j < src->cols; j++) {
-        unsigned char rgb[3];
-        rgb[0] = (unsigned char)(src->data[i][j].rgb[0] * 255);
-        rgb[1] = (unsigned char)(src->data[i][j].rgb[1] * 255);
-        rgb[2] = (unsigned char)(src->data[i][j].rgb[2] * 255);
-        fwrite(rgb, sizeof(unsigned char), 3, fp);
+      for (int c0 = 0; c0 < cols; c0 += size) {
+        int n = c0 + size < cols ? size : cols - c0;
+        unsigned char *out = line + 3 * c0;
+        if (image_cleared(src, i, c0)) {
+          for (int j = 0; j < n; j++)
+            memcpy(&out[3 * j], clear, 3);
+        } else {
+          image_toRGB(src, i, c0, n, out, band);
+        }
       }
+      fwrite(line, sizeof(unsigned char), (size_t)cols * 3, fp);
     }
+    free(line);
 
     if (fp != stdout)
       fclose(fp);
@@ -189,73 +548,283 @@ int image_write(Image *src, char *filename) {
   return -1;
 }
 
-FPixel image_getf(Image *src, int r, int c) { return src->data[r][c]; }
+// The accessors of an RGBA8 image read a byte b back as b / 255 and a depth
+// code as image_depthValue, and a pixel without depth as IMAGE_Z_CLEAR. The
+// pixels of a cleared tile read as the clear value would once stored.
+
+FPixel image_getf(Image *src, int r, int c) {
+  if (image_cleared(src, r, c))
+    return image_stored(src, src->clearValue);
+  if (src->layout == ImagePlanar) {
+    size_t i = image_index(src, r, c);
+    FPixel val = {{src->rgb[0][i], src->rgb[1][i], src->rgb[2][i]},
+                  src->alpha[i],
+                  src->depth[i]};
+    return val;
+  }
+  if (src->layout == ImageRGBA8) {
+    FPixel val = {{image_getc(src, r, c, 0), image_getc(src, r, c, 1),
+                   image_getc(src, r, c, 2)},
+                  image_geta(src, r, c),
+                  image_getz(src, r, c)};
+    return val;
+  }
+  return src->data[r][c];
+}
 
 float image_getc(Image *src, int r, int c, int b) {
+  if (image_cleared(src, r, c))
+    return image_stored(src, src->clearValue).rgb[b];
+  if (src->layout == ImagePlanar)
+    return src->rgb[b][image_index(src, r, c)];
+  if (src->layout == ImageRGBA8)
+    return src->rgba[4 * image_index(src, r, c) + b] / 255.0f;
   return src->data[r][c].rgb[b];
 }
 
-float image_geta(Image *src, int r, int c) { return src->data[r][c].a; }
+float image_geta(Image *src, int r, int c) {
+  if (image_cleared(src, r, c))
+    return image_stored(src, src->clearValue).a;
+  if (src->layout == ImagePlanar)
+    return src->alpha[image_index(src, r, c)];
+  if (src->layout == ImageRGBA8)
+    return src->rgba[4 * image_index(src, r, c) + 3] / 255.0f;
+  return src->data[r][c].a;
+}
 
-float image_getz(Image *src, int r, int c) { return src->data[r][c].z; }
+float image_getz(Image *src, int r, int c) {
+  if (image_cleared(src, r, c))
+    return image_stored(src, src->clearValue).z;
+  if (src->layout == ImagePlanar)
+    return src->depth[image_index(src, r, c)];
+  if (src->layout == ImageRGBA8) {
+    if (src->depthBits == 0)
+      return IMAGE_Z_CLEAR;
+    return image_depthValue(image_depthGet(src, image_index(src, r, c)),
+                            src->depthBits);
+  }
+  return src->data[r][c].z;
+}
 
-void image_setf(Image *src, int r, int c, FPixel val) { src->data[r][c] = val; }
+// The setters materialize the pixel's tile first, since the pixels next to it
+// have to keep reading as the clear value.
+
+void image_setf(Image *src, int r, int c, FPixel val) {
+  image_prepare(src, r, c);
+  if (src->layout == ImagePlanar) {
+    size_t i = image_index(src, r, c);
+    src->rgb[0][i] = val.rgb[0];
+    src->rgb[1][i] = val.rgb[1];
+    src->rgb[2][i] = val.rgb[2];
+    src->alpha[i] = val.a;
+    src->depth[i] = val.z;
+    return;
+  }
+  if (src->layout == ImageRGBA8) {
+    size_t i = image_index(src, r, c);
+    unsigned int word = image_packRGBA(val);
+    memcpy(src->rgba + 4 * i, &word, sizeof(word));
+    if (src->depthBits != 0)
+      image_depthSet(src, i, image_depthCode(val.z, src->depthBits));
+    return;
+  }
+  src->data[r][c] = val;
+}
 
 void image_setc(Image *src, int r, int c, int b, float val) {
-  src->data[r][c].rgb[b] = val;
+  image_prepare(src, r, c);
+  if (src->layout == ImagePlanar)
+    src->rgb[b][image_index(src, r, c)] = val;
+  else if (src->layout == ImageRGBA8)
+    src->rgba[4 * image_index(src, r, c) + b] = image_byte(val);
+  else
+    src->data[r][c].rgb[b] = val;
 }
 
 void image_seta(Image *src, int r, int c, float val) {
-  src->data[r][c].a = val;
+  image_prepare(src, r, c);
+  if (src->layout == ImagePlanar)
+    src->alpha[image_index(src, r, c)] = val;
+  else if (src->layout == ImageRGBA8)
+    src->rgba[4 * image_index(src, r, c) + 3] = image_byte(val);
+  else
+    src->data[r][c].a = val;
 }
 
 void image_setz(Image *src, int r, int c, float val) {
-  src->data[r][c].z = val;
+  image_prepare(src, r, c);
+  if (src->layout == ImagePlanar)
+    src->depth[image_index(src, r, c)] = val;
+  else if (src->layout == ImageRGBA8) {
+    if (src->depthBits != 0)
+      image_depthSet(src, image_index(src, r, c),
+                     image_depthCode(val, src->depthBits));
+  } else
+    src->data[r][c].z = val;
 }
 
 void image_reset(Image *src) {
   src->maxval = 255.0f;
-  for (int i = 0; i < src->rows; i++) {
-    for (int j = 0; j < src->cols; j++) {
-      src->data[i][j].rgb[0] = 0.0f;
-      src->data[i][j].rgb[1] = 0.0f;
-      src->data[i][j].rgb[2] = 0.0f;
-      src->data[i][j].a = 1.0f;
-      src->data[i][j].z = 1.0f;
-    }
-  }
+  image_fill(src, image_clear);
 }
 
 void image_fill(Image *src, FPixel val) {
-  for (int i = 0; i < src->rows; i++) {
-    for (int j = 0; j < src->cols; j++) {
-      src->data[i][j] = val;
+  src->clearValue = val;
+  if (src->cleared)
+    memset(src->cleared, 1, (size_t)src->tileRows * src->tileCols);
+}
+
+// Channels image_fillChannels stores.
+#define IMAGE_CHANNEL_RGB 1
+#define IMAGE_CHANNEL_A 2
+#define IMAGE_CHANNEL_Z 4
+
+// Store the channels of val in mask in the n pixels from index i on.
+static void image_storeChannels(Image *src, size_t i, long n, int mask,
+                                FPixel val) {
+  if (src->layout == ImagePlanar) {
+    if (mask & IMAGE_CHANNEL_RGB) {
+      for (int b = 0; b < 3; b++)
+        image_fillFloats(src->rgb[b] + i, n, val.rgb[b]);
+    }
+    if (mask & IMAGE_CHANNEL_A)
+      image_fillFloats(src->alpha + i, n, val.a);
+    if (mask & IMAGE_CHANNEL_Z)
+      image_fillFloats(src->depth + i, n, val.z);
+    return;
+  }
+  if (src->layout == ImageRGBA8) {
+    unsigned char *pixel = src->rgba + 4 * i;
+    if (mask & IMAGE_CHANNEL_RGB) {
+      unsigned char rb = image_byte(val.rgb[0]), gb = image_byte(val.rgb[1]),
+                    bb = image_byte(val.rgb[2]);
+      for (long j = 0; j < n; j++) {
+        pixel[4 * j] = rb;
+        pixel[4 * j + 1] = gb;
+        pixel[4 * j + 2] = bb;
+      }
+    }
+    if (mask & IMAGE_CHANNEL_A) {
+      unsigned char ab = image_byte(val.a);
+      for (long j = 0; j < n; j++)
+        pixel[4 * j + 3] = ab;
     }
+    if (mask & IMAGE_CHANNEL_Z) {
+      if (src->depthBits == 16)
+        image_fillShorts(src->depth16 + i, n, image_depthCode(val.z, 16));
+      else if (src->depthBits == 24)
+        image_fillWords(src->depth24 + i, n, image_depthCode(val.z, 24));
+    }
+    return;
+  }
+  FPixel *pixel = src->pixels + i;
+  for (long j = 0; j < n; j++) {
+    if (mask & IMAGE_CHANNEL_RGB) {
+      pixel[j].rgb[0] = val.rgb[0];
+      pixel[j].rgb[1] = val.rgb[1];
+      pixel[j].rgb[2] = val.rgb[2];
+    }
+    if (mask & IMAGE_CHANNEL_A)
+      pixel[j].a = val.a;
+    if (mask & IMAGE_CHANNEL_Z)
+      pixel[j].z = val.z;
   }
 }
 
-void image_fillrgb(Image *src, float r, float g, float b) {
-  for (int i = 0; i < src->rows; i++) {
-    for (int j = 0; j < src->cols; j++) {
-      src->data[i][j].rgb[0] = r;
-      src->data[i][j].rgb[1] = g;
-      src->data[i][j].rgb[2] = b;
+// Set the channels of every pixel in mask to those of val. Cleared tiles take
+// them in their clear value. If no tile is cleared the block is written as one
+// linear array, row padding included; otherwise only the tiles already
+// written are.
+static void image_fillChannels(Image *src, int mask, FPixel val) {
+  size_t tiles = (size_t)src->tileRows * src->tileCols;
+  if (mask & IMAGE_CHANNEL_RGB) {
+    for (int b = 0; b < 3; b++)
+      src->clearValue.rgb[b] = val.rgb[b];
+  }
+  if (mask & IMAGE_CHANNEL_A)
+    src->clearValue.a = val.a;
+  if (mask & IMAGE_CHANNEL_Z)
+    src->clearValue.z = val.z;
+
+  if (tiles == 0)
+    return;
+  if (memchr(src->cleared, 1, tiles) == NULL) {
+    image_storeChannels(src, 0, (long)src->rows * src->stride, mask, val);
+    return;
+  }
+  int size = 1 << IMAGE_TILE_SHIFT;
+  for (int tr = 0; tr < src->tileRows; tr++) {
+    const unsigned char *cleared = &src->cleared[tr * src->tileCols];
+    if (memchr(cleared, 0, src->tileCols) == NULL)
+      continue;
+    int r0 = tr * size, r1 = r0 + size < src->rows ? r0 + size : src->rows;
+    for (int r = r0; r < r1; r++) {
+      for (int tc = 0; tc < src->tileCols; tc++) {
+        if (cleared[tc])
+          continue;
+        int c0 = tc * size, n = c0 + size < src->cols ? size : src->cols - c0;
+        image_storeChannels(src, image_index(src, r, c0), n, mask, val);
+      }
     }
   }
 }
 
+void image_fillrgb(Image *src, float r, float g, float b) {
+  FPixel val = {{r, g, b}, 0.0f, 0.0f};
+  image_fillChannels(src, IMAGE_CHANNEL_RGB, val);
+}
+
 void image_filla(Image *src, float a) {
-  for (int i = 0; i < src->rows; i++) {
-    for (int j = 0; j < src->cols; j++) {
-      src->data[i][j].a = a;
-    }
-  }
+  FPixel val = {{0.0f, 0.0f, 0.0f}, a, 0.0f};
+  image_fillChannels(src, IMAGE_CHANNEL_A, val);
 }
 
 void image_fillz(Image *src, float z) {
-  for (int i = 0; i < src->rows; i++) {
-    for (int j = 0; j < src->cols; j++) {
-      src->data[i][j].z = z;
-    }
+  FPixel val = {{0.0f, 0.0f, 0.0f}, 0.0f, z};
+  image_fillChannels(src, IMAGE_CHANNEL_Z, val);
+}
+
+void image_fillSpan(Image *src, int row, int c0, int c1, FPixel val) {
+  if (row < 0 || row >= src->rows)
+    return;
+  if (c0 < 0)
+    c0 = 0;
+  if (c1 >= src->cols)
+    c1 = src->cols - 1;
+  if (c0 > c1)
+    return;
+
+  image_prepareSpan(src, row, c0, c1);
+  image_store(src, image_index(src, row, c0), c1 - c0 + 1, val);
+
+  if (src->hiz != NULL) {
+    // the pyramid bounds what was stored, which an RGBA8 depth code may have
+    // rounded down
+    float z = val.z;
+    if (src->layout == ImageRGBA8 && src->depthBits != 0)
+      z = image_depthValue(image_depthCode(z, src->depthBits), src->depthBits);
+    depthpyramid_fillSpan(src->hiz, row, c0, c1, z);
   }
 }
+
+// Depth test counters; the tile workers of module_draw_parallel add to them
+// concurrently.
+static atomic_long depth_tested;
+static atomic_long depth_rejected;
+
+void depthstats_add(long tested, long rejected) {
+  if (tested != 0) {
+    atomic_fetch_add(&depth_tested, tested);
+    atomic_fetch_add(&depth_rejected, rejected);
+  }
+}
+
+void depthstats_reset(void) {
+  atomic_store(&depth_tested, 0);
+  atomic_store(&depth_rejected, 0);
+}
+
+void depthstats_get(DepthStats *stats) {
+  stats->tested = atomic_load(&depth_tested);
+  stats->rejected = atomic_load(&depth_rejected);
+}
@@ -1,5 +1,8 @@
 #include "line.h"
+#include "clip.h"
+#include "depth_pyramid.h"
 #include "image.h"
+#include "trace.h"
 #include <math.h>
 #include <stdlib.h>
 
@@ -28,29 +31,283 @@ void line_copy(Line *to, Line *from) {
   to->zBuffer = from->zBuffer;
 }
 
-void line_draw(Line *l, Image *src, Color c) {
-  printf("drawing line (%.2f, %.2f) to (%.2f, %.2f)\n", l->a.val[0], l->a.val[1],
-         l->b.val[0], l->b.val[1]);
-  int x0 = (int)l->a.val[0];
-  int y0 = (int)l->a.val[1];
-  int x1 = (int)l->b.val[0];
-  int y1 = (int)l->b.val[1];
+// Cohen-Sutherland region codes of a pixel against the image.
+#define LINE_LEFT 1
+#define LINE_RIGHT 2
+#define LINE_TOP 4
+#define LINE_BOTTOM 8
+
+static int line_outcode(int x, int y, int rows, int cols) {
+  int code = 0;
+  if (x < 0)
+    code |= LINE_LEFT;
+  else if (x >= cols)
+    code |= LINE_RIGHT;
+  if (y < 0)
+    code |= LINE_TOP;
+  else if (y >= rows)
+    code |= LINE_BOTTOM;
+  return code;
+}
+
+// Cohen-Sutherland clip of the pixel endpoints of a line to the image. The
+// walk stays on a border row or column until the ideal line is half a pixel
+// past it, so each endpoint outside is moved to where the line crosses that
+// half-pixel border and then onto the border pixel, until both are inside.
+// Returns 0 if the line misses the image.
+static int line_clipPixels(int *x0, int *y0, int *x1, int *y1, int rows,
+                           int cols) {
+  int code0 = line_outcode(*x0, *y0, rows, cols);
+  int code1 = line_outcode(*x1, *y1, rows, cols);
+
+  while (code0 | code1) {
+    if (code0 & code1)
+      return 0;
+
+    int code = code0 ? code0 : code1;
+    double dx = *x1 - *x0;
+    double dy = *y1 - *y0;
+    int x, y;
+    if (code & LINE_TOP) {
+      y = 0;
+      x = (int)floor(*x0 + dx * (-0.5 - *y0) / dy + 0.5);
+    } else if (code & LINE_BOTTOM) {
+      y = rows - 1;
+      x = (int)floor(*x0 + dx * (rows - 0.5 - *y0) / dy + 0.5);
+    } else if (code & LINE_LEFT) {
+      x = 0;
+      y = (int)floor(*y0 + dy * (-0.5 - *x0) / dx + 0.5);
+    } else {
+      x = cols - 1;
+      y = (int)floor(*y0 + dy * (cols - 0.5 - *x0) / dx + 0.5);
+    }
+
+    if (code == code0) {
+      *x0 = x;
+      *y0 = y;
+      code0 = line_outcode(x, y, rows, cols);
+    } else {
+      *x1 = x;
+      *y1 = y;
+      code1 = line_outcode(x, y, rows, cols);
+    }
+  }
+  return 1;
+}
+
+// Find the pixel endpoints of the part of l that lies on src. Endpoints past
+// the guard band are first clipped to it in floating point, so that the
+// conversion to int stays in range. If z0 is not NULL, the z values of l, which
+// must vary linearly along it, are also carried to the two end pixels.
+// Returns 0 if nothing of l is visible.
+static int line_pixels(Line *l, Image *src, int *x0, int *y0, int *x1,
+                       int *y1, double *z0, double *z1) {
+  Point a = l->a, b = l->b;
+  double xmin = -CLIP_GUARD_BAND, xmax = src->cols + CLIP_GUARD_BAND;
+  double ymin = -CLIP_GUARD_BAND, ymax = src->rows + CLIP_GUARD_BAND;
+
+  if (a.val[0] < xmin || a.val[0] > xmax || a.val[1] < ymin ||
+      a.val[1] > ymax || b.val[0] < xmin || b.val[0] > xmax ||
+      b.val[1] < ymin || b.val[1] > ymax) {
+    ClipVolume band;
+    clip_rect(&band, xmin, ymin, xmax, ymax);
+    if (!clip_line(&band, &a, &b))
+      return 0;
+  }
+
+  int ax = (int)a.val[0], ay = (int)a.val[1];
+  int bx = (int)b.val[0], by = (int)b.val[1];
+  *x0 = ax;
+  *y0 = ay;
+  *x1 = bx;
+  *y1 = by;
+  if (!line_clipPixels(x0, y0, x1, y1, src->rows, src->cols))
+    return 0;
+
+  if (z0 != NULL) {
+    // where the clipped ends fall along the unclipped pixel line
+    double dx = bx - ax, dy = by - ay;
+    double len = dx * dx + dy * dy;
+    double t0 = len > 0 ? ((*x0 - ax) * dx + (*y0 - ay) * dy) / len : 0.0;
+    double t1 = len > 0 ? ((*x1 - ax) * dx + (*y1 - ay) * dy) / len : 1.0;
+    *z0 = t0 == 0.0 ? a.val[2] : a.val[2] + t0 * (b.val[2] - a.val[2]);
+    *z1 = t1 == 1.0 ? b.val[2] : a.val[2] + t1 * (b.val[2] - a.val[2]);
+  }
+  return 1;
+}
+
+static inline void line_setPixel(Image *src, int row, int col, Color c) {
+  size_t i = (size_t)row * src->stride + col;
+  image_prepare(src, row, col);
+  if (src->layout == ImageRGBA8) {
+    unsigned char *pixel = &src->rgba[4 * i];
+    pixel[0] = image_byte(c.c[0]);
+    pixel[1] = image_byte(c.c[1]);
+    pixel[2] = image_byte(c.c[2]);
+    pixel[3] = 255;
+    if (src->depthBits != 0)
+      image_depthSet(src, i, 0); // the code of IMAGE_Z_CLEAR
+  } else if (src->layout == ImagePlanar) {
+    src->rgb[0][i] = c.c[0];
+    src->rgb[1][i] = c.c[1];
+    src->rgb[2][i] = c.c[2];
+    src->alpha[i] = 1.0;
+    src->depth[i] = IMAGE_Z_CLEAR;
+  } else {
+    FPixel pixel;
+    pixel.rgb[0] = c.c[0];
+    pixel.rgb[1] = c.c[1];
+    pixel.rgb[2] = c.c[2];
+    pixel.a = 1.0; // Assuming full opacity for simplicity
+    pixel.z = IMAGE_Z_CLEAR; // no depth without the depth test
+    src->pixels[i] = pixel;
+  }
+  if (src->hiz != NULL)
+    depthpyramid_lower(src->hiz, row, col, IMAGE_Z_CLEAR);
+}
+
+// Depth-tested version of line_setPixel: draw the pixel only if 1/z is at
+// least the buffer's, so it is no further away than what is there. Ties go to
+// the later line, which keeps shared polygon edges drawn in the old order.
+// Returns 0 if the pixel was rejected.
+static inline int line_setPixelDepth(Image *src, int row, int col, Color c,
+                                     double z) {
+  float zf = (float)z;
+  size_t i = (size_t)row * src->stride + col;
+  image_prepare(src, row, col);
+  if (src->layout == ImageRGBA8) {
+    // the codes order like the values, with ties for values they round
+    // together
+    unsigned int code = image_depthCode(zf, src->depthBits);
+    if (code < image_depthGet(src, i))
+      return 0;
+    unsigned char *pixel = &src->rgba[4 * i];
+    pixel[0] = image_byte(c.c[0]);
+    pixel[1] = image_byte(c.c[1]);
+    pixel[2] = image_byte(c.c[2]);
+    pixel[3] = 255;
+    image_depthSet(src, i, code);
+  } else if (src->layout == ImagePlanar) {
+    if (zf < src->depth[i])
+      return 0;
+    src->rgb[0][i] = c.c[0];
+    src->rgb[1][i] = c.c[1];
+    src->rgb[2][i] = c.c[2];
+    src->alpha[i] = 1.0;
+    src->depth[i] = zf;
+  } else {
+    FPixel *pixel = &src->pixels[i];
+    if (zf < pixel->z)
+      return 0;
+    pixel->rgb[0] = c.c[0];
+    pixel->rgb[1] = c.c[1];
+    pixel->rgb[2] = c.c[2];
+    pixel->a = 1.0;
+    pixel->z = zf;
+  }
+  if (src->hiz != NULL)
+    depthpyramid_touch(src->hiz, row, col);
+  return 1;
+}
+
+// Whether line_draw depth-tests l on src. Lines with an end at z <= 0, such
+// as 2D lines, have no usable depth and are drawn as before, and so are lines
+// on an image without a depth buffer.
+static int line_depthTest(Line *l, Image *src) {
+  return l->zBuffer && l->a.val[2] > 0 && l->b.val[2] > 0 &&
+         image_hasDepth(src);
+}
+
+// The line l with its z values replaced by 1/z, which is what varies linearly
+// across the screen.
+static void line_inverseDepth(Line *l, Line *inv) {
+  *inv = *l;
+  inv->a.val[2] = 1.0 / l->a.val[2];
+  inv->b.val[2] = 1.0 / l->b.val[2];
+}
+
+// Bresenham walk from (x0, y0) to (x1, y1). Both ends are on the image, and
+// so is every pixel in between. If z is not NULL the walk is depth-tested,
+// with 1/z going from z[0] at the first pixel to z[1] at the last; each step
+// moves one pixel along the major axis, so it adds the same amount to it.
+static void line_bresenham(int x0, int y0, int x1, int y1, Image *src,
+                           Color c, const double *z) {
+  int dx = abs(x1 - x0);
+  int dy = abs(y1 - y0);
+  int sx = x0 < x1 ? 1 : -1;
+  int sy = y0 < y1 ? 1 : -1;
+  int err = dx - dy;
+
+  if (z == NULL) {
+    while (1) {
+      line_setPixel(src, y0, x0, c);
+
+      if (x0 == x1 && y0 == y1)
+        break;
+      int e2 = err * 2;
+      if (e2 > -dy) {
+        err -= dy;
+        x0 += sx;
+      }
+      if (e2 < dx) {
+        err += dx;
+        y0 += sy;
+      }
+    }
+    return;
+  }
+
+  int steps = dx > dy ? dx : dy;
+  double depth = z[0];
+  double dz = steps > 0 ? (z[1] - z[0]) / steps : 0.0;
+  long drawn = 0;
+  while (1) {
+    drawn += line_setPixelDepth(src, y0, x0, c, depth);
 
+    if (x0 == x1 && y0 == y1)
+      break;
+    int e2 = err * 2;
+    if (e2 > -dy) {
+      err -= dy;
+      x0 += sx;
+    }
+    if (e2 < dx) {
+      err += dx;
+      y0 += sy;
+    }
+    depth += dz;
+  }
+  depthstats_add(steps + 1, steps + 1 - drawn);
+}
+
+// The same walk, but only writing the pixels inside rows [r0, r1) and columns
+// [c0, c1). The walk is monotone in x and y, so once it has entered and left
+// the rectangle it can stop.
+static void line_bresenhamRect(int x0, int y0, int x1, int y1, Image *src,
+                               Color c, const double *z, int r0, int c0,
+                               int r1, int c1) {
   int dx = abs(x1 - x0);
   int dy = abs(y1 - y0);
   int sx = x0 < x1 ? 1 : -1;
   int sy = y0 < y1 ? 1 : -1;
   int err = dx - dy;
+  int entered = 0;
+  int steps = dx > dy ? dx : dy;
+  double depth = z != NULL ? z[0] : 0.0;
+  double dz = z != NULL && steps > 0 ? (z[1] - z[0]) / steps : 0.0;
+  long tested = 0, drawn = 0;
 
   while (1) {
-    if (x0 >= 0 && x0 < src->cols && y0 >= 0 && y0 < src->rows) {
-      FPixel pixel;
-      pixel.rgb[0] = c.c[0];
-      pixel.rgb[1] = c.c[1];
-      pixel.rgb[2] = c.c[2];
-      pixel.a = 1.0; // Assuming full opacity for simplicity
-      pixel.z = 0.0; // Assuming default depth for simplicity
-      src->data[y0][x0] = pixel;
+    if (x0 >= c0 && x0 < c1 && y0 >= r0 && y0 < r1) {
+      if (z == NULL) {
+        line_setPixel(src, y0, x0, c);
+      } else {
+        tested++;
+        drawn += line_setPixelDepth(src, y0, x0, c, depth);
+      }
+      entered = 1;
+    } else if (entered) {
+      break;
     }
 
     if (x0 == x1 && y0 == y1)
@@ -64,5 +321,46 @@ void line_draw(Line *l, Image *src, Color c) {
       err += dx;
       y0 += sy;
     }
+    depth += dz;
+  }
+  depthstats_add(tested, tested - drawn);
+}
+
+void line_draw(Line *l, Image *src, Color c) {
+  TRACE_PRIMITIVE("line_draw", "x0,y0,x1,y1", l->a.val[0], l->a.val[1],
+                  l->b.val[0], l->b.val[1]);
+  int x0, y0, x1, y1;
+  if (line_depthTest(l, src)) {
+    Line inv;
+    double z[2];
+    line_inverseDepth(l, &inv);
+    if (line_pixels(&inv, src, &x0, &y0, &x1, &y1, &z[0], &z[1]))
+      line_bresenham(x0, y0, x1, y1, src, c, z);
+  } else if (line_pixels(l, src, &x0, &y0, &x1, &y1, NULL, NULL)) {
+    line_bresenham(x0, y0, x1, y1, src, c, NULL);
+  }
+}
+
+void line_drawRect(Line *l, Image *src, Color c, int r0, int c0, int r1,
+                   int c1) {
+  if (r0 < 0)
+    r0 = 0;
+  if (c0 < 0)
+    c0 = 0;
+  if (r1 > src->rows)
+    r1 = src->rows;
+  if (c1 > src->cols)
+    c1 = src->cols;
+  if (r0 >= r1 || c0 >= c1)
+    return;
+  int x0, y0, x1, y1;
+  if (line_depthTest(l, src)) {
+    Line inv;
+    double z[2];
+    line_inverseDepth(l, &inv);
+    if (line_pixels(&inv, src, &x0, &y0, &x1, &y1, &z[0], &z[1]))
+      line_bresenhamRect(x0, y0, x1, y1, src, c, z, r0, c0, r1, c1);
+  } else if (line_pixels(l, src, &x0, &y0, &x1, &y1, NULL, NULL)) {
+    line_bresenhamRect(x0, y0, x1, y1, src, c, NULL, r0, c0, r1, c1);
   }
 }
@@ -0,0 +1,237 @@
+#include "../include/module_parallel.h"
+#include "../include/trace.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// A worker materializes lazily cleared tiles as it writes to them, so each of
+// those has to lie inside one render tile.
+_Static_assert(PARALLEL_TILE_SIZE % (1 << IMAGE_TILE_SHIFT) == 0,
+               "render tiles must be whole lazy-clear tiles");
+
+// One projected primitive, reduced to the pixel coordinates the serial draw
+// functions would compute for it.
+typedef struct {
+  int type;   // ObjLine or ObjPoint
+  int x0, y0; // start of a line, or the point
+  int x1, y1; // end of a line
+  double z0, z1; // depths of the ends of a line
+  int zBuffer;   // whether the line is depth-tested
+  Color c;
+} DrawCommand;
+
+// Work shared by the threads drawing one frame. Tiles are handed out in order
+// through next, so threads that finish early pick up the remaining tiles.
+typedef struct {
+  Image *src;
+  int tileCols;
+  int nTiles;
+  atomic_int next;
+} TileJob;
+
+// Command list and tile bins. Like the module_draw scratch buffers they only
+// grow, so steady state frames do not allocate.
+static DrawCommand *commands = NULL;
+static int nCommands = 0;
+static int commandsSize = 0;
+static int *tileStart = NULL; // commands of tile t are tileRefs[tileStart[t]..]
+static int tileStartSize = 0;
+static int *tileRefs = NULL;
+static int tileRefsSize = 0;
+
+// Grow *buf to hold at least n elements of size bytes each.
+static void *parallel_reserve(void *buf, int *capacity, int n, size_t size) {
+  if (n <= *capacity) {
+    return buf;
+  }
+  int cap = *capacity > 0 ? *capacity : 256;
+  while (cap < n) {
+    cap *= 2;
+  }
+  buf = realloc(buf, size * cap);
+  if (buf == NULL) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  *capacity = cap;
+  return buf;
+}
+
+static DrawCommand *record_command(int type, Color c) {
+  commands = (DrawCommand *)parallel_reserve(commands, &commandsSize,
+                                             nCommands + 1, sizeof(DrawCommand));
+  DrawCommand *cmd = &commands[nCommands++];
+  cmd->type = type;
+  cmd->c = c;
+  return cmd;
+}
+
+static void record_line(DrawSink *sink, Line *l, Color c) {
+  DrawCommand *cmd = record_command(ObjLine, c);
+  cmd->x0 = (int)l->a.val[0];
+  cmd->y0 = (int)l->a.val[1];
+  cmd->x1 = (int)l->b.val[0];
+  cmd->y1 = (int)l->b.val[1];
+  cmd->z0 = l->a.val[2];
+  cmd->z1 = l->b.val[2];
+  cmd->zBuffer = l->zBuffer;
+}
+
+static void record_point(DrawSink *sink, Point *p, Color c) {
+  DrawCommand *cmd = record_command(ObjPoint, c);
+  cmd->x0 = cmd->x1 = (int)p->val[0];
+  cmd->y0 = cmd->y1 = (int)p->val[1];
+}
+
+// Find the range of tiles the bounding box of cmd touches. Returns 0 if the
+// command lies entirely outside the image.
+static int command_tiles(DrawCommand *cmd, Image *src, int *tr0, int *tc0,
+                         int *tr1, int *tc1) {
+  int xmin = cmd->x0 < cmd->x1 ? cmd->x0 : cmd->x1;
+  int xmax = cmd->x0 < cmd->x1 ? cmd->x1 : cmd->x0;
+  int ymin = cmd->y0 < cmd->y1 ? cmd->y0 : cmd->y1;
+  int ymax = cmd->y0 < cmd->y1 ? cmd->y1 : cmd->y0;
+
+  if (xmax < 0 || ymax < 0 || xmin >= src->cols || ymin >= src->rows) {
+    return 0;
+  }
+  *tc0 = (xmin > 0 ? xmin : 0) / PARALLEL_TILE_SIZE;
+  *tr0 = (ymin > 0 ? ymin : 0) / PARALLEL_TILE_SIZE;
+  *tc1 = (xmax < src->cols ? xmax : src->cols - 1) / PARALLEL_TILE_SIZE;
+  *tr1 = (ymax < src->rows ? ymax : src->rows - 1) / PARALLEL_TILE_SIZE;
+  return 1;
+}
+
+// Sort the recorded commands into per-tile lists, keeping traversal order
+// within every tile.
+static void bin_commands(Image *src, int tileCols, int nTiles) {
+  int tr0, tc0, tr1, tc1;
+
+  tileStart = (int *)parallel_reserve(tileStart, &tileStartSize, nTiles + 1,
+                                      sizeof(int));
+  for (int t = 0; t <= nTiles; t++) {
+    tileStart[t] = 0;
+  }
+
+  // count the commands per tile, then turn the counts into offsets
+  for (int i = 0; i < nCommands; i++) {
+    if (command_tiles(&commands[i], src, &tr0, &tc0, &tr1, &tc1)) {
+      for (int tr = tr0; tr <= tr1; tr++) {
+        for (int tc = tc0; tc <= tc1; tc++) {
+          tileStart[tr * tileCols + tc + 1]++;
+        }
+      }
+    }
+  }
+  for (int t = 0; t < nTiles; t++) {
+    tileStart[t + 1] += tileStart[t];
+  }
+
+  // fill the lists, using tileStart[t] as the insert position of tile t - 1
+  // so that afterwards it is back to being the start of tile t
+  tileRefs = (int *)parallel_reserve(tileRefs, &tileRefsSize,
+                                     tileStart[nTiles], sizeof(int));
+  for (int i = 0; i < nCommands; i++) {
+    if (command_tiles(&commands[i], src, &tr0, &tc0, &tr1, &tc1)) {
+      for (int tr = tr0; tr <= tr1; tr++) {
+        for (int tc = tc0; tc <= tc1; tc++) {
+          tileRefs[tileStart[tr * tileCols + tc]++] = i;
+        }
+      }
+    }
+  }
+  for (int t = nTiles; t > 0; t--) {
+    tileStart[t] = tileStart[t - 1];
+  }
+  tileStart[0] = 0;
+}
+
+static void render_tile(Image *src, int tile, int tileCols) {
+  int r0 = (tile / tileCols) * PARALLEL_TILE_SIZE;
+  int c0 = (tile % tileCols) * PARALLEL_TILE_SIZE;
+  int r1 = r0 + PARALLEL_TILE_SIZE;
+  int c1 = c0 + PARALLEL_TILE_SIZE;
+
+  for (int i = tileStart[tile]; i < tileStart[tile + 1]; i++) {
+    DrawCommand *cmd = &commands[tileRefs[i]];
+    if (cmd->type == ObjPoint) {
+      // a point's bounding box is the point, so it is inside this tile
+      image_setColor(src, cmd->y0, cmd->x0, cmd->c);
+    } else {
+      Line l;
+      line_set2D(&l, cmd->x0, cmd->y0, cmd->x1, cmd->y1);
+      l.a.val[2] = cmd->z0;
+      l.b.val[2] = cmd->z1;
+      line_zBuffer(&l, cmd->zBuffer);
+      line_drawRect(&l, src, cmd->c, r0, c0, r1, c1);
+    }
+  }
+}
+
+static void *tile_worker(void *arg) {
+  TileJob *job = (TileJob *)arg;
+  int tile;
+
+  while ((tile = atomic_fetch_add(&job->next, 1)) < job->nTiles) {
+    render_tile(job->src, tile, job->tileCols);
+  }
+  return NULL;
+}
+
+void module_draw_parallel(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds,
+                          Lighting *lighting, Image *src, int nthreads) {
+  if (md == NULL || VTM == NULL || GTM == NULL || ds == NULL || src == NULL) {
+    fprintf(stderr, "Error: NULL argument to module_draw_parallel\n");
+    return;
+  }
+
+  TRACE_FRAME_BEGIN("module_draw_parallel");
+
+  // phase 1: traverse and record on the calling thread
+  DrawSink recorder;
+  recorder.line = record_line;
+  recorder.point = record_point;
+  nCommands = 0;
+  module_drawSink(md, VTM, GTM, ds, lighting, src, &recorder);
+
+  int tileRows = (src->rows + PARALLEL_TILE_SIZE - 1) / PARALLEL_TILE_SIZE;
+  int tileCols = (src->cols + PARALLEL_TILE_SIZE - 1) / PARALLEL_TILE_SIZE;
+  int nTiles = tileRows * tileCols;
+  if (nCommands == 0 || nTiles == 0) {
+    TRACE_FRAME_END("module_draw_parallel");
+    return;
+  }
+  bin_commands(src, tileCols, nTiles);
+  TRACE_FRAME("tiles binned", "commands,tiles,refs", nCommands, nTiles,
+              tileStart[nTiles]);
+
+  // phase 2: rasterize the tiles, the calling thread working alongside
+  TileJob job;
+  job.src = src;
+  job.tileCols = tileCols;
+  job.nTiles = nTiles;
+  atomic_init(&job.next, 0);
+
+  if (nthreads > PARALLEL_MAX_THREADS) {
+    nthreads = PARALLEL_MAX_THREADS;
+  }
+  if (nthreads > nTiles) {
+    nthreads = nTiles;
+  }
+
+  pthread_t threads[PARALLEL_MAX_THREADS];
+  int started = 0;
+  while (started < nthreads - 1) {
+    // if a thread cannot be created the remaining ones pick up its tiles
+    if (pthread_create(&threads[started], NULL, tile_worker, &job) != 0) {
+      break;
+    }
+    started++;
+  }
+  tile_worker(&job);
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  TRACE_FRAME_END("module_draw_parallel");
+}
@@ -24,9 +24,10 @@ void point_set(Point *p, double x, double y, double z, double h) {
 
 void point_normalize(Point *p) {
   if (p->val[3] != 0) {
+    // z is left alone: after a 3D view it holds the depth the depth buffer
+    // needs, which the divide would turn into a constant
     p->val[0] /= p->val[3];
     p->val[1] /= p->val[3];
-    p->val[2] /= p->val[3];
     p->val[3] = 1.0;
   }
 }
@@ -57,7 +58,7 @@ void point_drawf(Point *p, Image *src, FPixel c) {
     int y = (int)p->val[1];
 
     if (x >= 0 && x < src->cols && y >= 0 && y < src->rows) {
-        src->data[y][x] = c;
+        image_setf(src, y, x, c);
     } else {
         fprintf(stderr, "Point out of bounds: (%d, %d)\n", x, y);
     }
@@ -1,10 +1,23 @@
 #include "../include/polygon.h"
 #include "../include/line.h"
+#include "../include/trace.h"
 #include <stdio.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+// polygon_drawFillB tests the pixels of a tile four at a time with AVX or
+// SSE2 when the compiler targets them, unless TRANSFORM_SCALAR is defined.
+// The vector code does the same adds as the scalar code, so all three fill
+// the same pixels.
+#if !defined(TRANSFORM_SCALAR) && defined(__AVX__)
+#define POLYGON_AVX
+#include <immintrin.h>
+#elif !defined(TRANSFORM_SCALAR) && defined(__SSE2__)
+#define POLYGON_SSE2
+#include <emmintrin.h>
+#endif
+
 void *polygon_create() {
   Polygon *p = malloc(sizeof(Polygon));
   if (p == NULL) {
@@ -14,6 +27,7 @@ void *polygon_create() {
   p->oneSided = 0;
   p->nVertex = 0;
   p->vertex = NULL;
+  p->zBuffer = 1;
   return p;
 }
 
@@ -24,6 +38,7 @@ void *polygon_createp(int numV, Point *vlist) {
   }
 
   p->oneSided = 0;
+  p->zBuffer = 1;
   p->nVertex = numV;
   p->vertex = malloc(sizeof(Point) * numV);
   if (p->vertex == NULL) {
@@ -48,6 +63,7 @@ void polygon_init(Polygon *p) {
     p->oneSided = 0;
     p->nVertex = 0;
     p->vertex = NULL; // Set vertex pointer to NULL
+    p->zBuffer = 1;
   }
 }
 
@@ -73,6 +89,7 @@ void polygon_clear(Polygon *p) {
     p->vertex = NULL; // Reset vertex pointer
     p->nVertex = 0;
     p->oneSided = 0;
+    p->zBuffer = 1;
   }
 }
 
@@ -82,12 +99,19 @@ void polygon_setSided(Polygon *p, int oneSided) {
   }
 }
 
+void polygon_zBuffer(Polygon *p, int flag) {
+  if (p != NULL) {
+    p->zBuffer = flag;
+  }
+}
+
 void polygon_copy(Polygon *to, Polygon *from) {
   if (to == NULL || from == NULL) {
     return;
   }
 
   to->oneSided = from->oneSided;
+  to->zBuffer = from->zBuffer;
   to->nVertex = from->nVertex;
 
   to->vertex = malloc(sizeof(Point) * from->nVertex);
@@ -126,79 +150,253 @@ void polygon_draw(Polygon *p, Image *src, Color c) {
   if (p == NULL || src == NULL || p->nVertex < 2) {
     return; // Not enough vertices to form a line
   }
-  printf("Polygon: %d vertices\n", p->nVertex);
-  for (int i = 0; i < p->nVertex; i++) {
-    point_print(&p->vertex[i], stdout);
-  }
+  TRACE_PRIMITIVE("polygon_draw", "nVertex", p->nVertex);
 
   Line l;
   for (int i = 0; i < p->nVertex - 1; i++) {
     line_set(&l, p->vertex[i], p->vertex[i + 1]);
+    line_zBuffer(&l, p->zBuffer);
     line_draw(&l, src, c);
   }
   // Connect the last vertex back to the first to close the polygon
   line_set(&l, p->vertex[p->nVertex - 1], p->vertex[0]);
+  line_zBuffer(&l, p->zBuffer);
   line_draw(&l, src, c);
 }
 
+// Pixels of a triangle are filled an 8x8 tile at a time; see
+// polygon_drawFillB.
+#define FILL_TILE 8
+
+// Edge functions of a triangle in pixel index space. E_k(x, y) =
+// a[k] x + b[k] y + c[k] is the value of edge k at the center of pixel
+// (x, y), scaled so that the pixels inside the triangle are the ones where all
+// three are >= 0.
+typedef struct {
+  double a[3], b[3], c[3];
+} TriEdges;
+
+// Offsets a[k] * p of the pixels p = 0 .. FILL_TILE - 1 of a tile row from the
+// first one. A pixel's edge value is its row's value plus its offset.
+typedef struct {
+  double step[3][FILL_TILE];
+} TriSteps;
+
+// Color the pixels of row, starting at col, whose bits are set in mask.
+static inline void fill_mask(Image *src, int row, int col, int mask, Color c) {
+  size_t i = (size_t)row * src->stride + col;
+  if (mask == 0)
+    return;
+  image_prepareSpan(src, row, col, col + 31 - __builtin_clz((unsigned)mask));
+  if (src->layout == ImageRGBA8) {
+    unsigned char *pixel = &src->rgba[4 * i];
+    for (int p = 0; mask != 0; p++, mask >>= 1) {
+      if (mask & 1) {
+        pixel[4 * p] = image_byte(c.c[0]);
+        pixel[4 * p + 1] = image_byte(c.c[1]);
+        pixel[4 * p + 2] = image_byte(c.c[2]);
+      }
+    }
+    return;
+  }
+  if (src->layout == ImagePlanar) {
+    for (int p = 0; mask != 0; p++, mask >>= 1) {
+      if (mask & 1) {
+        src->rgb[0][i + p] = c.c[0];
+        src->rgb[1][i + p] = c.c[1];
+        src->rgb[2][i + p] = c.c[2];
+      }
+    }
+    return;
+  }
+  FPixel *pixel = &src->pixels[i];
+  for (int p = 0; mask != 0; p++, mask >>= 1) {
+    if (mask & 1) {
+      pixel[p].rgb[0] = c.c[0];
+      pixel[p].rgb[1] = c.c[1];
+      pixel[p].rgb[2] = c.c[2];
+    }
+  }
+}
+
+// Test each pixel of the w by h tile at (x, y) against the edges and color the
+// ones inside. rowE starts at the edge values of the top-left pixel and steps
+// down by b; each pixel adds its offset to it. The vector versions test four
+// pixels at a time with the same adds, so they fill the same pixels.
+static void fill_partialTile(const TriEdges *e, const TriSteps *s, Image *src,
+                             Color c, int x, int y, int w, int h) {
+  double rowE[3];
+  for (int k = 0; k < 3; k++)
+    rowE[k] = e->a[k] * x + e->b[k] * y + e->c[k];
+
+#if defined(POLYGON_AVX)
+  int all = (1 << w) - 1;
+  __m256d zero = _mm256_setzero_pd();
+  __m256d lo[3], hi[3];
+  for (int k = 0; k < 3; k++) {
+    lo[k] = _mm256_loadu_pd(&s->step[k][0]);
+    hi[k] = _mm256_loadu_pd(&s->step[k][4]);
+  }
+  for (int r = 0; r < h; r++) {
+    __m256d inLo = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    __m256d inHi = inLo;
+    for (int k = 0; k < 3; k++) {
+      __m256d base = _mm256_set1_pd(rowE[k]);
+      inLo = _mm256_and_pd(inLo, _mm256_cmp_pd(_mm256_add_pd(base, lo[k]),
+                                               zero, _CMP_GE_OQ));
+      inHi = _mm256_and_pd(inHi, _mm256_cmp_pd(_mm256_add_pd(base, hi[k]),
+                                               zero, _CMP_GE_OQ));
+      rowE[k] += e->b[k];
+    }
+    int mask = _mm256_movemask_pd(inLo) | _mm256_movemask_pd(inHi) << 4;
+    fill_mask(src, y + r, x, mask & all, c);
+  }
+#elif defined(POLYGON_SSE2)
+  int all = (1 << w) - 1;
+  __m128d zero = _mm_setzero_pd();
+  __m128d off[3][4];
+  for (int k = 0; k < 3; k++) {
+    for (int q = 0; q < 4; q++)
+      off[k][q] = _mm_loadu_pd(&s->step[k][2 * q]);
+  }
+  for (int r = 0; r < h; r++) {
+    int mask = 0;
+    // two pairs of pixels per group of four, up to two groups per row
+    for (int q = 0; q < 4 && 2 * q < w; q++) {
+      __m128d in = _mm_castsi128_pd(_mm_set1_epi32(-1));
+      for (int k = 0; k < 3; k++) {
+        __m128d value = _mm_add_pd(_mm_set1_pd(rowE[k]), off[k][q]);
+        in = _mm_and_pd(in, _mm_cmpge_pd(value, zero));
+      }
+      mask |= _mm_movemask_pd(in) << 2 * q;
+    }
+    for (int k = 0; k < 3; k++)
+      rowE[k] += e->b[k];
+    fill_mask(src, y + r, x, mask & all, c);
+  }
+#else
+  for (int r = 0; r < h; r++) {
+    int mask = 0;
+    for (int p = 0; p < w; p++) {
+      if (rowE[0] + s->step[0][p] >= 0 && rowE[1] + s->step[1][p] >= 0 &&
+          rowE[2] + s->step[2][p] >= 0)
+        mask |= 1 << p;
+    }
+    for (int k = 0; k < 3; k++)
+      rowE[k] += e->b[k];
+    fill_mask(src, y + r, x, mask, c);
+  }
+#endif
+}
+
 void polygon_drawFillB(Polygon *p, Image *src, Color c) {
   if (p->nVertex != 3)
     return; // Ensure there are 3 vertices to form a triangle
 
-  // Initialize bounding box values
-  float minX = p->vertex[0].val[0], maxX = minX;
-  float minY = p->vertex[0].val[1], maxY = minY;
-
-  // Find the bounding box of the polygon
-  for (int i = 1; i < p->nVertex; i++) {
-    float vx = p->vertex[i].val[0], vy = p->vertex[i].val[1];
-    if (vx < minX)
-      minX = vx;
-    if (vx > maxX)
-      maxX = vx;
-    if (vy < minY)
-      minY = vy;
-    if (vy > maxY)
-      maxY = vy;
-  }
-
-  // Define vertices A, B, C
-  float x1 = p->vertex[0].val[0], y1 = p->vertex[0].val[1];
-  float x2 = p->vertex[1].val[0], y2 = p->vertex[1].val[1];
-  float x3 = p->vertex[2].val[0], y3 = p->vertex[2].val[1];
-  // printf("x1: %f, y1: %f, x2: %f, y2: %f, x3: %f, y3: %f\n", x1, y1, x2, y2,
-  // x3, y3);
-
-  // Denominators for beta and gamma
-  float f_ca_beta = (y3 - y1) * x2 + (x1 - x3) * y2 + x3 * y1 - x1 * y3;
-  float f_ab_gamma = (y1 - y2) * x3 + (x2 - x1) * y3 + x1 * y2 - x2 * y1;
-
-  // Check if denominators are zero to avoid division by zero
-  if (f_ca_beta == 0 || f_ab_gamma == 0)
-    return; // Degenerate triangle (collinear vertices)
-
-  // Scan over bounding box and check each pixel
-  for (int y = (int)minY; y <= maxY; y++) {
-    for (int x = (int)minX; x <= maxX; x++) {
-
-      float px = x + 0.5; // Use center of the pixel
-      float py = y + 0.5;
-
-      // Calculate barycentric coordinates
-      float beta =
-          ((y3 - y1) * px + (x1 - x3) * py + x3 * y1 - x1 * y3) / f_ca_beta;
-      float gamma =
-          ((y1 - y2) * px + (x2 - x1) * py + x1 * y2 - x2 * y1) / f_ab_gamma;
-      float alpha = 1.0f - beta - gamma;
-
-      // Check if pixel is inside the triangle and all coordinates are within
-      // [0, 1]
-      if (alpha >= 0 && alpha <= 1 && beta >= 0 && beta <= 1 && gamma >= 0 &&
-          gamma <= 1) {
-        image_setColor(src, y, x, c); // Function to set the color of the pixel
+  // Move the vertices half a pixel so that (x, y) below is the center of
+  // pixel (x, y)
+  double vx[3], vy[3];
+  for (int i = 0; i < 3; i++) {
+    vx[i] = p->vertex[i].val[0] - 0.5;
+    vy[i] = p->vertex[i].val[1] - 0.5;
+  }
+
+  // Twice the signed area; zero for a degenerate triangle (collinear
+  // vertices)
+  double area = (vx[1] - vx[0]) * (vy[2] - vy[0]) -
+                (vx[2] - vx[0]) * (vy[1] - vy[0]);
+  if (area == 0 || area != area)
+    return;
+  double sign = area > 0 ? 1.0 : -1.0;
+
+  // Edge k runs from vertex k to vertex k + 1, with the third vertex on its
+  // positive side
+  TriEdges e;
+  TriSteps s;
+  for (int k = 0; k < 3; k++) {
+    int n = (k + 1) % 3;
+    e.a[k] = -(vy[n] - vy[k]) * sign;
+    e.b[k] = (vx[n] - vx[k]) * sign;
+    e.c[k] = -(e.a[k] * vx[k] + e.b[k] * vy[k]);
+    for (int i = 0; i < FILL_TILE; i++)
+      s.step[k][i] = e.a[k] * i;
+  }
+
+  // Pixels whose centers are in the bounding box, clipped to the image
+  double minX = fmin(vx[0], fmin(vx[1], vx[2]));
+  double maxX = fmax(vx[0], fmax(vx[1], vx[2]));
+  double minY = fmin(vy[0], fmin(vy[1], vy[2]));
+  double maxY = fmax(vy[0], fmax(vy[1], vy[2]));
+  minX = fmax(ceil(minX), 0.0);
+  minY = fmax(ceil(minY), 0.0);
+  maxX = fmin(floor(maxX), src->cols - 1.0);
+  maxY = fmin(floor(maxY), src->rows - 1.0);
+  if (!(minX <= maxX && minY <= maxY))
+    return;
+  int x0 = (int)minX, x1 = (int)maxX;
+  int y0 = (int)minY, y1 = (int)maxY;
+
+  TRACE_PRIMITIVE("polygon_drawFillB", "x0,y0,x1,y1", x0, y0, x1, y1);
+
+  // Walk the tiles of the image grid that the box touches
+  for (int ty = y0 - y0 % FILL_TILE; ty <= y1; ty += FILL_TILE) {
+    int ry0 = ty > y0 ? ty : y0;
+    int ry1 = ty + FILL_TILE - 1 < y1 ? ty + FILL_TILE - 1 : y1;
+    for (int tx = x0 - x0 % FILL_TILE; tx <= x1; tx += FILL_TILE) {
+      int rx0 = tx > x0 ? tx : x0;
+      int rx1 = tx + FILL_TILE - 1 < x1 ? tx + FILL_TILE - 1 : x1;
+
+      // The edge functions are linear, so their extremes over the tile are
+      // at its corners
+      int inside = 1;
+      int outside = 0;
+      for (int k = 0; k < 3 && !outside; k++) {
+        double lo = e.c[k], hi = e.c[k];
+        lo += e.a[k] * (e.a[k] >= 0 ? rx0 : rx1);
+        hi += e.a[k] * (e.a[k] >= 0 ? rx1 : rx0);
+        lo += e.b[k] * (e.b[k] >= 0 ? ry0 : ry1);
+        hi += e.b[k] * (e.b[k] >= 0 ? ry1 : ry0);
+        if (hi < 0)
+          outside = 1;
+        else if (lo < 0)
+          inside = 0;
+      }
+
+      if (outside)
+        continue;
+      if (inside) {
+        // fully covered: no per-pixel tests
+        for (int row = ry0; row <= ry1; row++) {
+          size_t i = (size_t)row * src->stride;
+          image_prepareSpan(src, row, rx0, rx1);
+          if (src->layout == ImageRGBA8) {
+            unsigned char *pixel = &src->rgba[4 * i];
+            for (int col = rx0; col <= rx1; col++) {
+              pixel[4 * col] = image_byte(c.c[0]);
+              pixel[4 * col + 1] = image_byte(c.c[1]);
+              pixel[4 * col + 2] = image_byte(c.c[2]);
+            }
+            continue;
+          }
+          if (src->layout == ImagePlanar) {
+            for (int b = 0; b < 3; b++) {
+              float *plane = src->rgb[b] + i;
+              for (int col = rx0; col <= rx1; col++)
+                plane[col] = c.c[b];
+            }
+            continue;
+          }
+          FPixel *pixel = src->pixels + i;
+          for (int col = rx0; col <= rx1; col++) {
+            pixel[col].rgb[0] = c.c[0];
+            pixel[col].rgb[1] = c.c[1];
+            pixel[col].rgb[2] = c.c[2];
+          }
+        }
+      } else {
+        fill_partialTile(&e, &s, src, c, rx0, ry0, rx1 - rx0 + 1,
+                         ry1 - ry0 + 1);
       }
-      // printf("x: %d, y: %d, alpha: %f, beta: %f, gamma: %f\n", x, y, alpha,
-      // beta, gamma);
     }
   }
 }
\ No newline at end of file
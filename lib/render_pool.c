@@ -0,0 +1,89 @@
+#include "../include/render_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Make room for one more entry in a free list of size entries.
+static void *renderpool_grow(void *list, int *size, size_t entry) {
+  int grown = *size > 0 ? 2 * *size : 4;
+  void *bigger = realloc(list, grown * entry);
+  if (bigger == NULL) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  *size = grown;
+  return bigger;
+}
+
+RenderPool *renderpool_create(int rows, int cols) {
+  RenderPool *pool = (RenderPool *)calloc(1, sizeof(RenderPool));
+  if (pool == NULL) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  pool->rows = rows;
+  pool->cols = cols;
+  return pool;
+}
+
+Image *renderpool_image(RenderPool *pool) {
+  if (pool->nImages == 0) {
+    Image *src = image_create(pool->rows, pool->cols);
+    if (src == NULL) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(EXIT_FAILURE);
+    }
+    pool->allocations++;
+    return src;
+  }
+
+  Image *src = pool->images[--pool->nImages];
+  // an image resized while it was out gets the pool's size back
+  if (src->rows != pool->rows || src->cols != pool->cols) {
+    if (image_alloc(src, pool->rows, pool->cols) != 0) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  image_reset(src);
+  src->hiz = NULL;
+  return src;
+}
+
+void renderpool_releaseImage(RenderPool *pool, Image *src) {
+  if (pool->nImages == pool->imageSize) {
+    pool->images = (Image **)renderpool_grow(pool->images, &pool->imageSize,
+                                             sizeof(Image *));
+  }
+  pool->images[pool->nImages++] = src;
+}
+
+DrawState *renderpool_drawstate(RenderPool *pool) {
+  if (pool->nStates == 0) {
+    pool->allocations++;
+    return drawstate_create();
+  }
+
+  DrawState *ds = pool->states[--pool->nStates];
+  drawstate_init(ds);
+  return ds;
+}
+
+void renderpool_releaseDrawState(RenderPool *pool, DrawState *ds) {
+  if (pool->nStates == pool->stateSize) {
+    pool->states = (DrawState **)renderpool_grow(pool->states, &pool->stateSize,
+                                                 sizeof(DrawState *));
+  }
+  pool->states[pool->nStates++] = ds;
+}
+
+void renderpool_free(RenderPool *pool) {
+  for (int i = 0; i < pool->nImages; i++) {
+    image_free(pool->images[i]);
+  }
+  for (int i = 0; i < pool->nStates; i++) {
+    free(pool->states[i]);
+  }
+  free(pool->images);
+  free(pool->states);
+  free(pool);
+}
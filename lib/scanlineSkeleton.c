@@ -5,13 +5,21 @@
         Skeleton scanline fill algorithm
 */
 
-#include "../include/list.h"
+#include "../include/clip.h"
+#include "../include/depth_pyramid.h"
 #include "../include/polygon.h"
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/* the depth-tested spans of planar images run four columns at a time with
+   SSE2 when the compiler targets it, unless TRANSFORM_SCALAR is defined */
+#if !defined(TRANSFORM_SCALAR) && defined(__SSE2__)
+#define SCANLINE_SSE2
+#include <emmintrin.h>
+#endif
+
 /********************
 Scanline Fill Algorithm
 ********************/
@@ -23,57 +31,57 @@ typedef struct tEdge {
   int yStart, yEnd;            /* start row and end row */
   float xIntersect, dxPerScan; /* where the edge intersects the current scanline
                                   and how it changes */
-                               /* we'll add more here later */
-  struct tEdge *next;
+  double zIntersect, dzPerScan; /* 1/z where the edge intersects the current
+                                   scanline and how it changes */
 } Edge;
 
 /*
-        This is a comparison function that returns a value < 0 if a < b, a
-        value > 0 if a > b, and 0 if a = b.  It uses the yStart field of the
-        Edge structure.  It is used to sort the overall edge list.
+        The edge table and the active edge list live in arrays that are kept
+        from one polygon to the next and only grow, so filling a polygon does
+        not call malloc once they are big enough.
+
+        edgeTable holds the edges bucketed by yStart: the edges starting on
+        row yMin + i are edgeTable[bucket[i]] to edgeTable[bucket[i + 1] - 1],
+        in the order the polygon lists them. active holds pointers to the
+        edges crossing the current scanline, sorted by xIntersect.
  */
-static int compYStart(const void *a, const void *b) {
-  Edge *ea = (Edge *)a;
-  Edge *eb = (Edge *)b;
-
-  return (ea->yStart - eb->yStart);
-}
-
-/*
-        This is a comparison function that returns a value < 0 if a < b, a
-        value > 0 if a > b, and 0 if a = b.  It uses the xIntersect field of the
-        Edge structure.  It is used to sort the active edge list.
- */
-static int compXIntersect(const void *a, const void *b) {
-  Edge *ea = (Edge *)a;
-  Edge *eb = (Edge *)b;
-
-  if (ea->xIntersect < eb->xIntersect)
-    return (-1);
-  else if (ea->xIntersect > eb->xIntersect)
-    return (1);
-
-  return (0);
+static Edge *edgeRecs = NULL;  // edges as built, in polygon order
+static int edgeRecsSize = 0;
+static Edge *edgeTable = NULL; // the same edges, bucketed by yStart
+static int edgeTableSize = 0;
+static Edge **active = NULL;   // active edge list
+static int activeSize = 0;
+static int *bucket = NULL;     // first edge of each row, plus an end marker
+static int bucketSize = 0;
+static Point *inverseVertex = NULL; // vertices with 1/z in place of z
+static int inverseVertexSize = 0;
+
+// Grow *buf to hold at least n elements of size bytes each.
+static void *scratch_reserve(void *buf, int *capacity, int n, size_t size) {
+  if (n <= *capacity)
+    return buf;
+  int cap = *capacity > 0 ? *capacity : 64;
+  while (cap < n)
+    cap *= 2;
+  buf = realloc(buf, size * cap);
+  if (buf == NULL) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  *capacity = cap;
+  return buf;
 }
 
 /*
-        Allocates, creates, fills out, and returns an Edge structure given
-        the inputs.
+        Fills out the Edge structure given the inputs. Returns 0 if the edge
+        does not cross any row of the image, in which case it is left out.
+        For a depth-tested polygon the z values of the points hold 1/z.
 
         Current inputs are just the start and end location in image space.
         Eventually, the points will be 3D and we'll add color and texture
         coordinates.
  */
-static Edge *makeEdgeRec(Point start, Point end, Image *src) {
-  // Allocate memory for the edge structure
-  Edge *edge = malloc(sizeof(Edge));
-  if (!edge) {
-    printf("Unable to allocate memory for an edge.\n");
-    return NULL;
-  }
-  // printf("Edge: (%f, %f) -> (%f, %f)\n", start.val[0], start.val[1],
-  //        end.val[0], end.val[1]);
-
+static int makeEdgeRec(Edge *edge, Point start, Point end, Image *src) {
   // Initialize the edge structure with start and end points
   edge->x0 = start.val[0];
   edge->y0 = start.val[1];
@@ -81,11 +89,8 @@ static Edge *makeEdgeRec(Point start, Point end, Image *src) {
   edge->y1 = end.val[1];
 
   // Clip the edge if it starts below the image or ends above the image
-  if (edge->y1 < 0 || edge->y0 >= src->rows) {
-    free(edge);
-    // printf("Edge is outside the image. 84\n");
-    return NULL;
-  }
+  if (edge->y1 < 0 || edge->y0 >= src->rows)
+    return 0;
 
   // Adjust y0 to the nearest integer and assign it to yStart
   edge->yStart = (int)(edge->y0 + 0.5);
@@ -100,11 +105,8 @@ static Edge *makeEdgeRec(Point start, Point end, Image *src) {
 
   // Check if the edge should be included based on its position relative to the
   // image
-  if (edge->yStart >= src->rows || edge->yEnd < 0) {
-    // printf("Edge is outside the image. 102\n");
-    free(edge);
-    return NULL;
-  }
+  if (edge->yStart >= src->rows || edge->yEnd < 0)
+    return 0;
 
   // Calculate the slope of the edge
   float dscan = end.val[1] - start.val[1];
@@ -114,9 +116,15 @@ static Edge *makeEdgeRec(Point start, Point end, Image *src) {
   edge->xIntersect =
       edge->x0 + (0.5 - (edge->y0 - edge->yStart)) * edge->dxPerScan;
 
+  // 1/z is linear in screen space as well, so it steps the same way
+  edge->dzPerScan = (end.val[2] - start.val[2]) / dscan;
+  edge->zIntersect =
+      start.val[2] + (0.5 - (edge->y0 - edge->yStart)) * edge->dzPerScan;
+
   // Adjust the edge if it starts above the image
   if (edge->yStart < 0) {
     edge->xIntersect += (-edge->yStart) * edge->dxPerScan;
+    edge->zIntersect += (-edge->yStart) * edge->dzPerScan;
     edge->y0 = 0;
     edge->yStart = 0;
   }
@@ -124,27 +132,26 @@ static Edge *makeEdgeRec(Point start, Point end, Image *src) {
   // Check for steep slopes that might cause xIntersect to go beyond the edge's
   // x1
   if ((edge->dxPerScan > 0 && edge->xIntersect > fmaxf(edge->x0, edge->x1)) ||
-      (edge->dxPerScan < 0 && edge->xIntersect < fminf(edge->x0, edge->x1))) {
-    free(edge);
-    // printf("Steep edge 127\n");
-    return NULL;
-  }
+      (edge->dxPerScan < 0 && edge->xIntersect < fminf(edge->x0, edge->x1)))
+    return 0;
 
-  // Return the initialized edge structure
-  return edge;
+  return 1;
 }
 
 /*
-        Returns a list of all the edges in the polygon in sorted order by
-        smallest row.
+        Builds the edge table for the polygon and returns the number of edges
+        in it. On return the edges starting on row *yMin + i are
+        edgeTable[bucket[i]] to edgeTable[bucket[i + 1] - 1].
 */
-static LinkedList *setupEdgeList(Polygon *p, Image *src) {
-  LinkedList *edges = NULL;
+static int setupEdgeList(Polygon *p, Image *src, int *yMin) {
   Point v1, v2;
-  int i;
+  int i, n = 0;
 
-  // create a linked list
-  edges = ll_new();
+  // a polygon has at most one edge per vertex
+  edgeRecs = scratch_reserve(edgeRecs, &edgeRecsSize, p->nVertex, sizeof(Edge));
+  edgeTable =
+      scratch_reserve(edgeTable, &edgeTableSize, p->nVertex, sizeof(Edge));
+  active = scratch_reserve(active, &activeSize, p->nVertex, sizeof(Edge *));
 
   // walk around the polygon, starting with the last point
   v1 = p->vertex[p->nVertex - 1];
@@ -154,62 +161,168 @@ static LinkedList *setupEdgeList(Polygon *p, Image *src) {
     // the current point (i) is the end of the segment
     v2 = p->vertex[i];
 
-    // printf("Segment: (%f, %f) -> (%f, %f)\n", v1.val[0], v1.val[1],
-    // v2.val[0],
-    //        v2.val[1]);
     // if it is not a horizontal line
     if ((int)(v1.val[1] + 0.5) != (int)(v2.val[1] + 0.5)) {
-      Edge *edge;
-      // printf("Segment: (%f, %f) -> (%f, %f)\n", v1.val[0], v1.val[1],
-      //        v2.val[0], v2.val[1]);
       // if the first coordinate is smaller (top edge)
       if (v1.val[1] < v2.val[1])
-        edge = makeEdgeRec(v1, v2, src);
+        n += makeEdgeRec(&edgeRecs[n], v1, v2, src);
       else
-        edge = makeEdgeRec(v2, v1, src);
-
-      // insert the edge into the list of edges if it's not null
-      if (edge) {
-        ll_insert(edges, edge, compYStart);
-        // printf("Edge: (%f, %f) -> (%f, %f)\n", edge->x0, edge->y0, edge->x1,
-        //        edge->y1);
-      }
+        n += makeEdgeRec(&edgeRecs[n], v2, v1, src);
     }
     v1 = v2;
   }
 
   // check for empty edges (like nothing in the viewport)
-  if (ll_empty(edges)) {
-    ll_delete(edges, NULL);
-    edges = NULL;
+  if (n == 0)
+    return 0;
+
+  // bucket the edges by starting row with a counting sort
+  int lo = edgeRecs[0].yStart, hi = lo;
+  for (i = 1; i < n; i++) {
+    if (edgeRecs[i].yStart < lo)
+      lo = edgeRecs[i].yStart;
+    if (edgeRecs[i].yStart > hi)
+      hi = edgeRecs[i].yStart;
   }
+  int rows = hi - lo + 1;
+  bucket = scratch_reserve(bucket, &bucketSize, rows + 1, sizeof(int));
+  memset(bucket, 0, sizeof(int) * (rows + 1));
+  for (i = 0; i < n; i++)
+    bucket[edgeRecs[i].yStart - lo + 1]++;
+  for (i = 0; i < rows; i++)
+    bucket[i + 1] += bucket[i];
+  for (i = 0; i < n; i++)
+    edgeTable[bucket[edgeRecs[i].yStart - lo]++] = edgeRecs[i];
+  // the placing loop moved each bucket start to the next one's; shift back
+  for (i = rows; i > 0; i--)
+    bucket[i] = bucket[i - 1];
+  bucket[0] = 0;
+
+  *yMin = lo;
+  return n;
+}
+
+#if defined(SCANLINE_SSE2)
+/* lanes of a where mask is set, lanes of b elsewhere */
+static inline __m128 select_ps(__m128 mask, __m128 a, __m128 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
 
-  return (edges);
+/*
+        Depth-tested span of a planar image: columns startCol to endCol of
+        row scan, with 1/z = z0 + (col - x0) * dzPerCol at each column,
+        computed with the same float and double steps as the interleaved
+        loop in fillScan. Works on the planes directly and returns the
+        number of pixels that failed the test.
+ */
+static long fillSpanPlanar(Image *src, int scan, int startCol, int endCol,
+                           double z0, float x0, double dzPerCol, Color c) {
+  size_t row = (size_t)scan * src->stride;
+  float *red = src->rgb[0] + row;
+  float *green = src->rgb[1] + row;
+  float *blue = src->rgb[2] + row;
+  float *alpha = src->alpha + row;
+  float *zbuf = src->depth + row;
+  long rejected = 0;
+  int col = startCol;
+
+#if defined(SCANLINE_SSE2)
+  __m128d zStart = _mm_set1_pd(z0);
+  __m128d step = _mm_set1_pd(dzPerCol);
+  __m128 xStart = _mm_set1_ps(x0);
+  __m128 r = _mm_set1_ps(c.c[0]);
+  __m128 g = _mm_set1_ps(c.c[1]);
+  __m128 b = _mm_set1_ps(c.c[2]);
+  __m128 one = _mm_set1_ps(1.0f);
+  for (; col + 3 <= endCol; col += 4) {
+    __m128 off = _mm_sub_ps(
+        _mm_setr_ps((float)col, (float)(col + 1), (float)(col + 2),
+                    (float)(col + 3)),
+        xStart);
+    __m128d lo = _mm_add_pd(zStart, _mm_mul_pd(_mm_cvtps_pd(off), step));
+    __m128d hi = _mm_add_pd(
+        zStart, _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(off, off)), step));
+    __m128 zf = _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+
+    /* the scalar loop rejects zf < old, so NaNs pass here as they do there */
+    __m128 old = _mm_loadu_ps(zbuf + col);
+    __m128 pass = _mm_cmpnlt_ps(zf, old);
+    int mask = _mm_movemask_ps(pass);
+    rejected += 4 - __builtin_popcount(mask);
+    if (mask == 0)
+      continue;
+    _mm_storeu_ps(red + col, select_ps(pass, r, _mm_loadu_ps(red + col)));
+    _mm_storeu_ps(green + col, select_ps(pass, g, _mm_loadu_ps(green + col)));
+    _mm_storeu_ps(blue + col, select_ps(pass, b, _mm_loadu_ps(blue + col)));
+    _mm_storeu_ps(alpha + col, select_ps(pass, one, _mm_loadu_ps(alpha + col)));
+    _mm_storeu_ps(zbuf + col, select_ps(pass, zf, old));
+  }
+#endif
+  for (; col <= endCol; col++) {
+    float zf = (float)(z0 + (col - x0) * dzPerCol);
+    if (zf < zbuf[col]) {
+      rejected++;
+      continue;
+    }
+    red[col] = c.c[0];
+    green[col] = c.c[1];
+    blue[col] = c.c[2];
+    alpha[col] = 1.0;
+    zbuf[col] = zf;
+  }
+  return rejected;
+}
+
+/*
+        Depth-tested span of an RGBA8 image with depth, like fillSpanPlanar:
+        each column's 1/z is turned into a depth code and compared with the
+        stored one, and a pixel that passes takes the color's four bytes,
+        made once for the span.
+ */
+static long fillSpanRGBA8(Image *src, int scan, int startCol, int endCol,
+                          double z0, float x0, double dzPerCol, Color c) {
+  size_t row = (size_t)scan * src->stride;
+  unsigned char bytes[4] = {image_byte(c.c[0]), image_byte(c.c[1]),
+                            image_byte(c.c[2]), 255};
+  unsigned int word;
+  memcpy(&word, bytes, sizeof(word));
+  unsigned int *pixel = (unsigned int *)src->rgba + row;
+  int bits = src->depthBits;
+  long rejected = 0;
+
+  for (int col = startCol; col <= endCol; col++) {
+    float zf = (float)(z0 + (col - x0) * dzPerCol);
+    unsigned int code = image_depthCode(zf, bits);
+    if (code < image_depthGet(src, row + col)) {
+      rejected++;
+      continue;
+    }
+    pixel[col] = word;
+    image_depthSet(src, row + col, code);
+  }
+  return rejected;
 }
 
 /*
         Draw one scanline of a polygon given the scanline, the active edges,
         a DrawState, the image, and some Lights (for Phong shading only).
+        If depth is not NULL every pixel is depth-tested and counted in it.
  */
-static void fillScan(int scan, LinkedList *active, Image *src, Color c) {
-  Edge *p1, *p2;
-
-  // Loop over the list
-  p1 = ll_head(active);
-  while (p1) {
-    // The edges have to come in pairs, draw from one to the next
-    p2 = ll_next(active);
-    if (!p2) {
-      printf("bad bad bad (your edges are not coming in pairs)\n");
-      break;
-    }
+static void fillScan(int scan, Edge **active, int nActive, Image *src,
+                     Color c, DepthStats *depth) {
+  FPixel span = {{c.c[0], c.c[1], c.c[2]}, 1.0, IMAGE_Z_CLEAR};
+  int i;
+
+  // The edges have to come in pairs, draw from one to the next
+  for (i = 0; i + 1 < nActive; i += 2) {
+    Edge *p1 = active[i];
+    Edge *p2 = active[i + 1];
 
     // If the xIntersect values are the same, don't draw anything.
     // Just go to the next pair.
-    if (p2->xIntersect == p1->xIntersect) {
-      p1 = ll_next(active);
+    if (p2->xIntersect == p1->xIntersect)
       continue;
-    }
 
     // Identify the starting column and clip to the left side of the image
     int startCol = (int)(p1->xIntersect + 0.5); // Round to nearest pixel column
@@ -221,108 +334,210 @@ static void fillScan(int scan, LinkedList *active, Image *src, Color c) {
     if (endCol >= src->cols)
       endCol = src->cols - 1; // Clip to right edge
 
-    // Loop from start to end and color in the pixels
-    for (int col = startCol; col <= endCol; col++) {
-      if (col >= 0 && col < src->cols && scan >= 0 && scan < src->rows) {
-        src->data[scan][col].rgb[0] = c.c[0];
-        src->data[scan][col].rgb[1] = c.c[1];
-        src->data[scan][col].rgb[2] = c.c[2];
-        src->data[scan][col].a = 1.0; // Assuming full opacity
+    // Color in the pixels from start to end. Without the depth test the
+    // span is one constant pixel, with no depth, like a line's.
+    if (depth == NULL) {
+      image_fillSpan(src, scan, startCol, endCol, span);
+      continue;
+    }
+
+    // Same, keeping only the pixels that are not behind what is there. 1/z
+    // is computed from the span start at every column rather than stepped,
+    // so the planar loop, which does four columns at once, gets the same
+    // values.
+    double dzPerCol = (p2->zIntersect - p1->zIntersect) /
+                      (p2->xIntersect - p1->xIntersect);
+    // the tiles still cleared get their pixels before the test reads them
+    if (startCol <= endCol)
+      image_prepareSpan(src, scan, startCol, endCol);
+    if (src->layout == ImagePlanar) {
+      if (startCol <= endCol) {
+        depth->tested += endCol - startCol + 1;
+        depth->rejected += fillSpanPlanar(src, scan, startCol, endCol,
+                                          p1->zIntersect, p1->xIntersect,
+                                          dzPerCol, c);
+      }
+    } else if (src->layout == ImageRGBA8) {
+      if (startCol <= endCol) {
+        depth->tested += endCol - startCol + 1;
+        depth->rejected += fillSpanRGBA8(src, scan, startCol, endCol,
+                                         p1->zIntersect, p1->xIntersect,
+                                         dzPerCol, c);
+      }
+    } else {
+      FPixel *row = src->pixels + (size_t)scan * src->stride;
+      for (int col = startCol; col <= endCol; col++) {
+        FPixel *pixel = &row[col];
+        float zf = (float)(p1->zIntersect + (col - p1->xIntersect) * dzPerCol);
+        depth->tested++;
+        if (zf < pixel->z) {
+          depth->rejected++;
+          continue;
+        }
+        pixel->rgb[0] = c.c[0];
+        pixel->rgb[1] = c.c[1];
+        pixel->rgb[2] = c.c[2];
+        pixel->a = 1.0;
+        pixel->z = zf;
       }
     }
+    if (src->hiz != NULL && startCol <= endCol)
+      depthpyramid_touchSpan(src->hiz, scan, startCol, endCol);
+  }
+  if (i < nActive)
+    printf("bad bad bad (your edges are not coming in pairs)\n");
+}
 
-    // Move ahead to the next pair of edges
-    p1 = ll_next(active);
+/*
+        Insertion sort of the active edges by xIntersect. The list only
+        changes a little from one scanline to the next, so this is close to
+        linear.
+ */
+static void sortActive(Edge **active, int nActive) {
+  for (int i = 1; i < nActive; i++) {
+    Edge *e = active[i];
+    int j = i;
+    while (j > 0 && active[j - 1]->xIntersect > e->xIntersect) {
+      active[j] = active[j - 1];
+      j--;
+    }
+    active[j] = e;
   }
 }
 
 /*
-         Process the edge list, assumes the edges list has at least one entry
+         Process the edge table, assumes it has at least one entry
 */
-static int processEdgeList(LinkedList *edges, Image *src, Color c) {
-  LinkedList *active = NULL;
-  LinkedList *tmplist = NULL;
-  LinkedList *transfer = NULL;
-  Edge *current;
-  Edge *tedge;
-  int scan = 0;
-
-  active = ll_new();
-  tmplist = ll_new();
-
-  // get a pointer to the first item on the list and reset the current pointer
-  current = ll_head(edges);
+static int processEdgeList(int nEdges, int yMin, Image *src, Color c,
+                           DepthStats *depth) {
+  int nActive = 0;
+  int next = 0; // first edge of the table not yet active
+  int scan;
 
   // start at the first scanline and go until the active list is empty
-  for (scan = current->yStart; scan < src->rows; scan++) {
+  for (scan = yMin; scan < src->rows; scan++) {
 
     // grab all edges starting on this row
-    while (current != NULL && current->yStart == scan) {
-      ll_insert(active, current, compXIntersect);
-      current = ll_next(edges);
+    if (next < nEdges && edgeTable[next].yStart == scan) {
+      int end = bucket[scan - yMin + 1];
+      while (next < end)
+        active[nActive++] = &edgeTable[next++];
+      sortActive(active, nActive);
     }
-    // current is either null, or the first edge to be handled on some future
+    // next is either nEdges, or the first edge to be handled on some future
     // scanline
 
-    if (ll_empty(active)) {
+    if (nActive == 0) {
       break;
     }
 
     // if there are active edges
     // fill out the scanline
-    fillScan(scan, active, src, c);
+    fillScan(scan, active, nActive, src, c, depth);
 
     // remove any ending edges and update the rest
-    for (tedge = ll_pop(active); tedge != NULL; tedge = ll_pop(active)) {
+    int kept = 0;
+    for (int i = 0; i < nActive; i++) {
+      Edge *tedge = active[i];
 
       // keep anything that's not ending
       if (tedge->yEnd > scan) {
-        float a = 1.0;
-
         // update the edge information with the dPerScan values
         tedge->xIntersect += tedge->dxPerScan;
+        tedge->zIntersect += tedge->dzPerScan;
 
         // adjust in the case of partial overlap
         if (tedge->dxPerScan < 0.0 && tedge->xIntersect < tedge->x1) {
-          a = (tedge->xIntersect - tedge->x1) / tedge->dxPerScan;
           tedge->xIntersect = tedge->x1;
         } else if (tedge->dxPerScan > 0.0 && tedge->xIntersect > tedge->x1) {
-          a = (tedge->xIntersect - tedge->x1) / tedge->dxPerScan;
           tedge->xIntersect = tedge->x1;
         }
 
-        ll_insert(tmplist, tedge, compXIntersect);
+        active[kept++] = tedge;
       }
     }
-
-    transfer = active;
-    active = tmplist;
-    tmplist = transfer;
+    nActive = kept;
+    sortActive(active, nActive);
   }
 
-  // get rid of the lists, but not the edge records
-  ll_delete(active, NULL);
-  ll_delete(tmplist, NULL);
-
   return (0);
 }
 
+// Scratch space for the guard band clip. It only grows.
+static ClipScratch fillClipScratch;
+
 /*
         Draws a filled polygon of the specified color into the image src.
  */
 void polygon_drawFill(Polygon *p, Image *src, Color c) {
-  LinkedList *edges = NULL;
+  Polygon clipped, inverse;
+  DepthStats depth = {0, 0};
 
-  // set up the edge list
-  edges = setupEdgeList(p, src);
-  if (!edges)
+  if (p->nVertex < 3)
     return;
 
-  // process the edge list (should be able to take an arbitrary edge list)
-  processEdgeList(edges, src, c);
+  // bounding box of the polygon in screen space
+  double minX = p->vertex[0].val[0], maxX = minX;
+  double minY = p->vertex[0].val[1], maxY = minY;
+  for (int i = 1; i < p->nVertex; i++) {
+    double x = p->vertex[i].val[0], y = p->vertex[i].val[1];
+    minX = x < minX ? x : minX;
+    maxX = x > maxX ? x : maxX;
+    minY = y < minY ? y : minY;
+    maxY = y > maxY ? y : maxY;
+  }
+
+  // trivially reject polygons that are entirely off one side of the image;
+  // the margin of two pixels covers the rounding of the edge positions
+  if (maxX < -2 || minX > src->cols + 1 || maxY < -2 || minY > src->rows + 1)
+    return;
+
+  // a depth-tested polygon is filled with 1/z in place of z, so that the
+  // guard band clip and the edges interpolate what is linear on screen
+  int depthTest = p->zBuffer && image_hasDepth(src);
+  for (int i = 0; i < p->nVertex && depthTest; i++)
+    depthTest = p->vertex[i].val[2] > 0;
+  if (depthTest) {
+    inverseVertex = scratch_reserve(inverseVertex, &inverseVertexSize,
+                                    p->nVertex, sizeof(Point));
+    for (int i = 0; i < p->nVertex; i++) {
+      inverseVertex[i] = p->vertex[i];
+      inverseVertex[i].val[2] = 1.0 / p->vertex[i].val[2];
+    }
+    inverse = *p;
+    inverse.vertex = inverseVertex;
+    p = &inverse;
+  }
+
+  // polygons that reach past the guard band are clipped to it, so the float
+  // edge positions keep their precision; everything inside it is filled as is
+  double band = CLIP_GUARD_BAND;
+  if (minX < -band || maxX > src->cols + band || minY < -band ||
+      maxY > src->rows + band) {
+    ClipVolume cv;
+    Point *vertex;
+    unsigned char *edge;
+    clip_rect(&cv, -band, -band, src->cols + band, src->rows + band);
+    clipped.oneSided = p->oneSided;
+    clipped.zBuffer = p->zBuffer;
+    clipped.nVertex =
+        clip_polygon(&cv, p->vertex, p->nVertex, &fillClipScratch, &vertex,
+                     &edge);
+    clipped.vertex = vertex;
+    if (clipped.nVertex < 3)
+      return;
+    p = &clipped;
+  }
+
+  // set up the edge table
+  int yMin;
+  int nEdges = setupEdgeList(p, src, &yMin);
+  if (nEdges == 0)
+    return;
 
-  // clean up
-  ll_delete(edges, (void (*)(const void *))free);
+  // process the edge table
+  processEdgeList(nEdges, yMin, src, c, depthTest ? &depth : NULL);
+  depthstats_add(depth.tested, depth.rejected);
 
   return;
 }
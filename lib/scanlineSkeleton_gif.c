@@ -227,10 +227,8 @@ static void fillScan(int scan, LinkedList *active, Image *src, Color c) {
     
     for (int col = startCol; col <= endCol; col++) {
       if (col >= 0 && col < src->cols && scan >= 0 && scan < src->rows) {
-        src->data[scan][col].rgb[0] = c.c[0];
-        src->data[scan][col].rgb[1] = c.c[1];
-        src->data[scan][col].rgb[2] = c.c[2];
-        src->data[scan][col].a = 1.0; // Assuming full opacity
+        image_setColor(src, scan, col, c);
+        image_seta(src, scan, col, 1.0); // Assuming full opacity
 
         // output the image to ppm format - change the filename based on count like out1.ppm out2.ppm out3.ppm
         char buf[256];
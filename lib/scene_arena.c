@@ -0,0 +1,99 @@
+#include "../include/scene_arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Every allocation is rounded up to this many bytes so that doubles, pointers
+// and SSE loads are always aligned.
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(n) (((n) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_HEADER ARENA_ROUND(sizeof(ArenaBlock))
+
+static ArenaBlock *arenablock_create(size_t size) {
+  ArenaBlock *block = (ArenaBlock *)malloc(ARENA_HEADER + size);
+  if (block == NULL) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+SceneArena *scenearena_create(size_t blockSize) {
+  SceneArena *arena = (SceneArena *)malloc(sizeof(SceneArena));
+  if (arena == NULL) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  arena->blockSize = blockSize > 0 ? ARENA_ROUND(blockSize) : SCENE_ARENA_BLOCK_SIZE;
+  arena->head = arenablock_create(arena->blockSize);
+  arena->bytesUsed = 0;
+  return arena;
+}
+
+void *scenearena_alloc(SceneArena *arena, size_t size) {
+  ArenaBlock *block;
+
+  size = ARENA_ROUND(size > 0 ? size : 1);
+
+  // oversized requests get a dedicated block behind the current one so the
+  // free space left in the head block is not wasted
+  if (size > arena->blockSize) {
+    block = arenablock_create(size);
+    block->next = arena->head->next;
+    arena->head->next = block;
+  } else {
+    if (arena->head->used + size > arena->head->size) {
+      block = arenablock_create(arena->blockSize);
+      block->next = arena->head;
+      arena->head = block;
+    }
+    block = arena->head;
+  }
+
+  void *mem = (unsigned char *)block + ARENA_HEADER + block->used;
+  block->used += size;
+  arena->bytesUsed += size;
+  return mem;
+}
+
+void scenearena_reset(SceneArena *arena) {
+  if (arena == NULL) {
+    return;
+  }
+
+  // free every block except one regular sized block, which is rewound and
+  // kept for the next scene
+  ArenaBlock *keep = NULL;
+  ArenaBlock *block = arena->head;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    if (keep == NULL && block->size == arena->blockSize) {
+      keep = block;
+    } else {
+      free(block);
+    }
+    block = next;
+  }
+
+  block = keep != NULL ? keep : arenablock_create(arena->blockSize);
+  block->next = NULL;
+  block->used = 0;
+  arena->head = block;
+  arena->bytesUsed = 0;
+}
+
+void scenearena_free(SceneArena *arena) {
+  if (arena == NULL) {
+    return;
+  }
+
+  ArenaBlock *block = arena->head;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  free(arena);
+}
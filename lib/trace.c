@@ -0,0 +1,131 @@
+#include "../include/trace.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if (TRACE_BUFFER_SIZE & (TRACE_BUFFER_SIZE - 1)) != 0
+#error "TRACE_BUFFER_SIZE must be a power of two"
+#endif
+
+// One slot of the ring buffer. seq is index + 1 of the event the slot holds,
+// or 0 while a writer is filling it in.
+typedef struct {
+  atomic_ulong seq;
+  const char *name;
+  const char *argNames;
+  char phase;
+  int tid;
+  int nargs;
+  double ts; // microseconds on the monotonic clock
+  double args[TRACE_MAX_ARGS];
+} TraceEvent;
+
+static TraceEvent trace_ring[TRACE_BUFFER_SIZE];
+static atomic_ulong trace_head; // index of the next event to be written
+static atomic_int trace_nextTid;
+static _Thread_local int trace_tid;
+
+static double trace_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e6 + t.tv_nsec * 1e-3;
+}
+
+void trace_emit(const char *name, const char *argNames, char phase,
+                const double *args, int nargs) {
+  if (trace_tid == 0) {
+    trace_tid = atomic_fetch_add(&trace_nextTid, 1) + 1;
+  }
+
+  // claiming an index is the only shared write, so writers never wait
+  unsigned long idx =
+      atomic_fetch_add_explicit(&trace_head, 1, memory_order_relaxed);
+  TraceEvent *e = &trace_ring[idx & (TRACE_BUFFER_SIZE - 1)];
+
+  atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  e->name = name;
+  e->argNames = argNames;
+  e->phase = phase;
+  e->tid = trace_tid;
+  e->nargs = nargs < TRACE_MAX_ARGS ? nargs : TRACE_MAX_ARGS;
+  e->ts = trace_now();
+  if (e->nargs > 0) {
+    memcpy(e->args, args, sizeof(double) * e->nargs);
+  }
+  atomic_store_explicit(&e->seq, idx + 1, memory_order_release);
+}
+
+// Write the name of argument i, taken from the comma separated list names.
+static void trace_writeArgName(FILE *fp, const char *names, int i) {
+  const char *s = names;
+  for (int k = 0; s != NULL && k < i; k++) {
+    s = strchr(s, ',');
+    if (s != NULL) {
+      s++;
+    }
+  }
+  if (s == NULL) {
+    fprintf(fp, "\"%d\"", i);
+    return;
+  }
+  size_t len = strcspn(s, ",");
+  fprintf(fp, "\"%.*s\"", (int)len, s);
+}
+
+int trace_export(const char *filename) {
+  FILE *fp = fopen(filename, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Error: unable to open trace file %s\n", filename);
+    return -1;
+  }
+
+  unsigned long head = atomic_load_explicit(&trace_head, memory_order_acquire);
+  unsigned long start = head > TRACE_BUFFER_SIZE ? head - TRACE_BUFFER_SIZE : 0;
+  int count = 0;
+
+  fprintf(fp, "{\"traceEvents\":[\n");
+  for (unsigned long idx = start; idx < head; idx++) {
+    TraceEvent *e = &trace_ring[idx & (TRACE_BUFFER_SIZE - 1)];
+    // skip slots that were overwritten or are still being written
+    if (atomic_load_explicit(&e->seq, memory_order_acquire) != idx + 1) {
+      continue;
+    }
+
+    fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+            count > 0 ? ",\n" : "", e->name, e->phase, e->ts, e->tid);
+    if (e->phase == 'i') {
+      fprintf(fp, ",\"s\":\"t\"");
+    }
+    if (e->nargs > 0) {
+      fprintf(fp, ",\"args\":{");
+      for (int i = 0; i < e->nargs; i++) {
+        if (i > 0) {
+          fputc(',', fp);
+        }
+        trace_writeArgName(fp, e->argNames, i);
+        if (isfinite(e->args[i])) {
+          fprintf(fp, ":%.9g", e->args[i]);
+        } else {
+          fprintf(fp, ":null");
+        }
+      }
+      fputc('}', fp);
+    }
+    fputc('}', fp);
+    count++;
+  }
+  fprintf(fp, "\n]}\n");
+
+  fclose(fp);
+  return count;
+}
+
+void trace_clear(void) {
+  for (int i = 0; i < TRACE_BUFFER_SIZE; i++) {
+    atomic_store_explicit(&trace_ring[i].seq, 0, memory_order_relaxed);
+  }
+  atomic_store_explicit(&trace_head, 0, memory_order_release);
+}
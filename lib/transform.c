@@ -2,6 +2,24 @@
 #include <math.h>
 #include <stdio.h>
 
+// The matrix and point kernels use AVX or SSE2 when the compiler targets them,
+// unless TRANSFORM_SCALAR is defined. Every vector kernel does the same
+// multiplies and adds in the same order as the scalar code and never uses
+// FMA, so all three versions give bit-identical results. (A build that turns
+// on FMA, e.g. with -march=native, also needs -ffp-contract=off to keep that.)
+// The kernels load points as doubles, so GEOMETRY_FLOAT builds use the scalar
+// code.
+#if defined(GEOMETRY_FLOAT) && !defined(TRANSFORM_SCALAR)
+#define TRANSFORM_SCALAR
+#endif
+#if !defined(TRANSFORM_SCALAR) && defined(__AVX__)
+#define TRANSFORM_AVX
+#include <immintrin.h>
+#elif !defined(TRANSFORM_SCALAR) && defined(__SSE2__)
+#define TRANSFORM_SSE2
+#include <emmintrin.h>
+#endif
+
 /// Vector Functions
 
 void vector_set(Vector *v, double x, double y, double z) {
@@ -91,6 +109,7 @@ void matrix_clear(Matrix *m) {
                 m->m[i][j] = 0.0;
             }
         }
+        m->kind = MatrixProjective;
     }
 }
 
@@ -100,6 +119,7 @@ void matrix_identity(Matrix *m) {
         for (int i = 0; i < 4; i++) {
             m->m[i][i] = 1.0;
         }
+        m->kind = MatrixIdentity;
     }
 }
 
@@ -113,7 +133,40 @@ double matrix_get(Matrix *m, int r, int c) {
 void matrix_set(Matrix *m, int r, int c, double v) {
     if (m != NULL && r >= 0 && r < 4 && c >= 0 && c < 4) {
         m->m[r][c] = v;
+        matrix_classify(m);
+    }
+}
+
+MatrixKind matrix_classify(Matrix *m) {
+    if (m == NULL) {
+        return MatrixProjective;
+    }
+    if (m->m[3][0] != 0.0 || m->m[3][1] != 0.0 || m->m[3][2] != 0.0 || m->m[3][3] != 1.0) {
+        m->kind = MatrixProjective;
+        return m->kind;
+    }
+    int diagonal = 1, unit = 1, moved = 0;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            if (i != j && m->m[i][j] != 0.0) {
+                diagonal = 0;
+            }
+        }
+        if (m->m[i][i] != 1.0) {
+            unit = 0;
+        }
+        if (m->m[i][3] != 0.0) {
+            moved = 1;
+        }
+    }
+    if (diagonal && unit) {
+        m->kind = moved ? MatrixTranslate : MatrixIdentity;
+    } else if (diagonal && !moved) {
+        m->kind = MatrixScale;
+    } else {
+        m->kind = MatrixAffine;
     }
+    return m->kind;
 }
 
 void matrix_copy(Matrix *dest, Matrix *src) {
@@ -123,6 +176,7 @@ void matrix_copy(Matrix *dest, Matrix *src) {
                 dest->m[i][j] = src->m[i][j];
             }
         }
+        dest->kind = src->kind;
     }
 }
 
@@ -135,70 +189,446 @@ void matrix_transpose(Matrix *m) {
                 m->m[j][i] = temp;
             }
         }
+        // only the symmetric kinds survive a transpose
+        if (m->kind != MatrixIdentity && m->kind != MatrixScale) {
+            matrix_classify(m);
+        }
+    }
+}
+
+// The kind of left * right.
+static MatrixKind matrix_productKind(MatrixKind left, MatrixKind right) {
+    if (left == MatrixIdentity) {
+        return right;
+    }
+    if (right == MatrixIdentity || left == right) {
+        return left;
+    }
+    if (left == MatrixProjective || right == MatrixProjective) {
+        return MatrixProjective;
+    }
+    if ((left == MatrixRigid || left == MatrixTranslate) &&
+        (right == MatrixRigid || right == MatrixTranslate)) {
+        return MatrixRigid;
+    }
+    return MatrixAffine;
+}
+
+// The full 4x4 product. m may be left or right.
+static void multiply_general(const Matrix *left, const Matrix *right, Matrix *m) {
+#if defined(TRANSFORM_AVX)
+    // row i of the product is sum_k left[i][k] * right row k, accumulated
+    // from zero like the scalar loop
+    __m256d r0 = _mm256_loadu_pd(right->m[0]);
+    __m256d r1 = _mm256_loadu_pd(right->m[1]);
+    __m256d r2 = _mm256_loadu_pd(right->m[2]);
+    __m256d r3 = _mm256_loadu_pd(right->m[3]);
+    __m256d row[4];
+    for (int i = 0; i < 4; i++) {
+        __m256d sum = _mm256_setzero_pd();
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_broadcast_sd(&left->m[i][0]), r0));
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_broadcast_sd(&left->m[i][1]), r1));
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_broadcast_sd(&left->m[i][2]), r2));
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_broadcast_sd(&left->m[i][3]), r3));
+        row[i] = sum;
+    }
+    // every row is computed before any is stored, so m may alias left or right
+    for (int i = 0; i < 4; i++) {
+        _mm256_storeu_pd(m->m[i], row[i]);
+    }
+#elif defined(TRANSFORM_SSE2)
+    __m128d row[4][2];
+    for (int i = 0; i < 4; i++) {
+        __m128d lo = _mm_setzero_pd(), hi = _mm_setzero_pd();
+        for (int k = 0; k < 4; k++) {
+            __m128d l = _mm_set1_pd(left->m[i][k]);
+            lo = _mm_add_pd(lo, _mm_mul_pd(l, _mm_loadu_pd(&right->m[k][0])));
+            hi = _mm_add_pd(hi, _mm_mul_pd(l, _mm_loadu_pd(&right->m[k][2])));
+        }
+        row[i][0] = lo;
+        row[i][1] = hi;
+    }
+    for (int i = 0; i < 4; i++) {
+        _mm_storeu_pd(&m->m[i][0], row[i][0]);
+        _mm_storeu_pd(&m->m[i][2], row[i][1]);
+    }
+#else
+    Matrix temp;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            double sum = 0.0;
+            for (int k = 0; k < 4; k++) {
+                sum += left->m[i][k] * right->m[k][j];
+            }
+            temp.m[i][j] = sum;
+        }
+    }
+    *m = temp;
+#endif
+}
+
+// The product of two matrices whose bottom rows are 0 0 0 1. The products with
+// those zeros are left out, which cannot change any sum, so the result is the
+// same as multiply_general's. m may be left or right.
+static void multiply_affine(const Matrix *left, const Matrix *right, Matrix *m) {
+#if defined(TRANSFORM_AVX)
+    __m256d r0 = _mm256_loadu_pd(right->m[0]);
+    __m256d r1 = _mm256_loadu_pd(right->m[1]);
+    __m256d r2 = _mm256_loadu_pd(right->m[2]);
+    __m256d row[3];
+    for (int i = 0; i < 3; i++) {
+        __m256d sum = _mm256_setzero_pd();
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_broadcast_sd(&left->m[i][0]), r0));
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_broadcast_sd(&left->m[i][1]), r1));
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_broadcast_sd(&left->m[i][2]), r2));
+        // right row 3 is 0 0 0 1, so only the h column gains left[i][3]
+        row[i] = _mm256_add_pd(sum, _mm256_set_pd(left->m[i][3], 0.0, 0.0, 0.0));
+    }
+    for (int i = 0; i < 3; i++) {
+        _mm256_storeu_pd(m->m[i], row[i]);
+    }
+#elif defined(TRANSFORM_SSE2)
+    __m128d row[3][2];
+    for (int i = 0; i < 3; i++) {
+        __m128d lo = _mm_setzero_pd(), hi = _mm_setzero_pd();
+        for (int k = 0; k < 3; k++) {
+            __m128d l = _mm_set1_pd(left->m[i][k]);
+            lo = _mm_add_pd(lo, _mm_mul_pd(l, _mm_loadu_pd(&right->m[k][0])));
+            hi = _mm_add_pd(hi, _mm_mul_pd(l, _mm_loadu_pd(&right->m[k][2])));
+        }
+        row[i][0] = lo;
+        row[i][1] = _mm_add_pd(hi, _mm_set_pd(left->m[i][3], 0.0));
+    }
+    for (int i = 0; i < 3; i++) {
+        _mm_storeu_pd(&m->m[i][0], row[i][0]);
+        _mm_storeu_pd(&m->m[i][2], row[i][1]);
+    }
+#else
+    Matrix temp;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            double sum = 0.0;
+            for (int k = 0; k < 3; k++) {
+                sum += left->m[i][k] * right->m[k][j];
+            }
+            temp.m[i][j] = j == 3 ? sum + left->m[i][3] : sum;
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            m->m[i][j] = temp.m[i][j];
+        }
     }
+#endif
+    m->m[3][0] = 0.0;
+    m->m[3][1] = 0.0;
+    m->m[3][2] = 0.0;
+    m->m[3][3] = 1.0;
 }
 
 void matrix_multiply(Matrix *left, Matrix *right, Matrix *m) {
     if (left != NULL && right != NULL && m != NULL) {
-        Matrix temp;
-        for (int i = 0; i < 4; i++) {
-            for (int j = 0; j < 4; j++) {
-                double sum = 0.0;
-                for (int k = 0; k < 4; k++) {
-                    sum += left->m[i][k] * right->m[k][j];
+        MatrixKind kind = matrix_productKind(left->kind, right->kind);
+        if (left->kind == MatrixIdentity) {
+            *m = *right;
+        } else if (right->kind == MatrixIdentity) {
+            *m = *left;
+        } else if (left->kind == MatrixTranslate && right->kind != MatrixProjective) {
+            // only the translation column of right changes
+            double t0 = left->m[0][3], t1 = left->m[1][3], t2 = left->m[2][3];
+            *m = *right;
+            m->m[0][3] += t0;
+            m->m[1][3] += t1;
+            m->m[2][3] += t2;
+        } else if (left->kind == MatrixScale && right->kind != MatrixProjective) {
+            // each of the top three rows of right is scaled
+            double s[3] = {left->m[0][0], left->m[1][1], left->m[2][2]};
+            *m = *right;
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 4; j++) {
+                    m->m[i][j] *= s[i];
                 }
-                temp.m[i][j] = sum;
             }
+        } else if (left->kind != MatrixProjective && right->kind != MatrixProjective) {
+            multiply_affine(left, right, m);
+        } else {
+            multiply_general(left, right, m);
+        }
+        m->kind = kind;
+    }
+}
+
+// q = m * p in scalar code. p and q may be the same.
+static inline void transform_scalar(const Matrix *m, const Coord *p, Coord *q) {
+    double x = p[0], y = p[1], z = p[2], w = p[3];
+    double q0 = m->m[0][0] * x + m->m[0][1] * y + m->m[0][2] * z + m->m[0][3] * w;
+    double q1 = m->m[1][0] * x + m->m[1][1] * y + m->m[1][2] * z + m->m[1][3] * w;
+    double q2 = m->m[2][0] * x + m->m[2][1] * y + m->m[2][2] * z + m->m[2][3] * w;
+    double q3 = m->m[3][0] * x + m->m[3][1] * y + m->m[3][2] * z + m->m[3][3] * w;
+    q[0] = q0;
+    q[1] = q1;
+    q[2] = q2;
+    q[3] = q3;
+}
+
+// q = m * p for an affine or rigid m, whose h row is 0 0 0 1, so h passes
+// through unchanged. p and q may be the same.
+static inline void transform_affine(const Matrix *m, const Coord *p, Coord *q) {
+    double x = p[0], y = p[1], z = p[2], w = p[3];
+    double q0 = m->m[0][0] * x + m->m[0][1] * y + m->m[0][2] * z + m->m[0][3] * w;
+    double q1 = m->m[1][0] * x + m->m[1][1] * y + m->m[1][2] * z + m->m[1][3] * w;
+    double q2 = m->m[2][0] * x + m->m[2][1] * y + m->m[2][2] * z + m->m[2][3] * w;
+    q[0] = q0;
+    q[1] = q1;
+    q[2] = q2;
+    q[3] = w;
+}
+
+// q = m * p for the kinds that need no more than one operation per
+// coordinate: identity, translate and scale. Returns 0 without touching q for
+// every other kind. p and q may be the same.
+static inline int transform_special(const Matrix *m, const Coord *p, Coord *q) {
+    switch (m->kind) {
+    case MatrixIdentity:
+        for (int i = 0; i < 4; i++) {
+            q[i] = p[i];
         }
-        matrix_copy(m, &temp);
+        return 1;
+    case MatrixTranslate: {
+        double w = p[3];
+        q[0] = p[0] + m->m[0][3] * w;
+        q[1] = p[1] + m->m[1][3] * w;
+        q[2] = p[2] + m->m[2][3] * w;
+        q[3] = w;
+        return 1;
+    }
+    case MatrixScale:
+        q[0] = m->m[0][0] * p[0];
+        q[1] = m->m[1][1] * p[1];
+        q[2] = m->m[2][2] * p[2];
+        q[3] = p[3];
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Normalize q like point_normalize.
+static inline void transform_divide(Coord *q) {
+    if (q[3] != 0) {
+        double h = q[3];
+        q[0] /= h;
+        q[1] /= h;
+        q[3] = 1.0;
+    }
+}
+
+// The columns of a matrix, laid out for the vector point kernels. Each output
+// of m * p is m[i][0] * p0 + m[i][1] * p1 + m[i][2] * p2 + m[i][3] * p3 summed
+// left to right, exactly as written out in the scalar version.
+typedef struct {
+#if defined(TRANSFORM_AVX)
+    __m256d col[4];
+#elif defined(TRANSFORM_SSE2)
+    __m128d lo[4]; // rows 0 and 1 of each column
+    __m128d hi[4]; // rows 2 and 3 of each column
+#else
+    const Matrix *m; // the scalar code reads the rows in place
+#endif
+} XformColumns;
+
+static inline void transform_columns(const Matrix *m, XformColumns *c) {
+#if defined(TRANSFORM_AVX)
+    // transpose the rows of m into columns
+    __m256d a = _mm256_loadu_pd(m->m[0]);
+    __m256d b = _mm256_loadu_pd(m->m[1]);
+    __m256d cc = _mm256_loadu_pd(m->m[2]);
+    __m256d d = _mm256_loadu_pd(m->m[3]);
+    __m256d ab0 = _mm256_unpacklo_pd(a, b); // a0 b0 a2 b2
+    __m256d ab1 = _mm256_unpackhi_pd(a, b); // a1 b1 a3 b3
+    __m256d cd0 = _mm256_unpacklo_pd(cc, d);
+    __m256d cd1 = _mm256_unpackhi_pd(cc, d);
+    c->col[0] = _mm256_permute2f128_pd(ab0, cd0, 0x20);
+    c->col[1] = _mm256_permute2f128_pd(ab1, cd1, 0x20);
+    c->col[2] = _mm256_permute2f128_pd(ab0, cd0, 0x31);
+    c->col[3] = _mm256_permute2f128_pd(ab1, cd1, 0x31);
+#elif defined(TRANSFORM_SSE2)
+    for (int j = 0; j < 4; j += 2) {
+        __m128d a = _mm_loadu_pd(&m->m[0][j]), b = _mm_loadu_pd(&m->m[1][j]);
+        __m128d cc = _mm_loadu_pd(&m->m[2][j]), d = _mm_loadu_pd(&m->m[3][j]);
+        c->lo[j] = _mm_unpacklo_pd(a, b);
+        c->lo[j + 1] = _mm_unpackhi_pd(a, b);
+        c->hi[j] = _mm_unpacklo_pd(cc, d);
+        c->hi[j + 1] = _mm_unpackhi_pd(cc, d);
+    }
+#else
+    c->m = m;
+#endif
+}
+
+// q = m * p with the columns of m from transform_columns. p and q may be the
+// same; if divide is non-zero q is normalized like point_normalize.
+static inline void transform_apply(const XformColumns *c, const Coord *p,
+                                   Coord *q, int divide) {
+#if defined(TRANSFORM_AVX)
+    __m256d sum = _mm256_mul_pd(c->col[0], _mm256_broadcast_sd(&p[0]));
+    sum = _mm256_add_pd(sum, _mm256_mul_pd(c->col[1], _mm256_broadcast_sd(&p[1])));
+    sum = _mm256_add_pd(sum, _mm256_mul_pd(c->col[2], _mm256_broadcast_sd(&p[2])));
+    sum = _mm256_add_pd(sum, _mm256_mul_pd(c->col[3], _mm256_broadcast_sd(&p[3])));
+    _mm256_storeu_pd(q, sum);
+#elif defined(TRANSFORM_SSE2)
+    __m128d p0 = _mm_set1_pd(p[0]), p1 = _mm_set1_pd(p[1]);
+    __m128d p2 = _mm_set1_pd(p[2]), p3 = _mm_set1_pd(p[3]);
+    __m128d lo = _mm_mul_pd(c->lo[0], p0);
+    lo = _mm_add_pd(lo, _mm_mul_pd(c->lo[1], p1));
+    lo = _mm_add_pd(lo, _mm_mul_pd(c->lo[2], p2));
+    lo = _mm_add_pd(lo, _mm_mul_pd(c->lo[3], p3));
+    __m128d hi = _mm_mul_pd(c->hi[0], p0);
+    hi = _mm_add_pd(hi, _mm_mul_pd(c->hi[1], p1));
+    hi = _mm_add_pd(hi, _mm_mul_pd(c->hi[2], p2));
+    hi = _mm_add_pd(hi, _mm_mul_pd(c->hi[3], p3));
+    _mm_storeu_pd(&q[0], lo);
+    _mm_storeu_pd(&q[2], hi);
+#else
+    transform_scalar(c->m, p, q);
+#endif
+    if (divide) {
+        transform_divide(q);
+    }
+}
+
+// q = m * p by the cheapest kernel for the kind of m. For a single point the
+// SSE2 transpose costs more than it saves, so only the AVX build uses the
+// column kernel here.
+static inline void transform_point(const Matrix *m, const Coord *p, Coord *q) {
+    if (transform_special(m, p, q)) {
+        return;
+    }
+#if defined(TRANSFORM_AVX)
+    XformColumns c;
+    transform_columns(m, &c);
+    transform_apply(&c, p, q, 0);
+#else
+    if (m->kind != MatrixProjective) {
+        transform_affine(m, p, q);
+    } else {
+        transform_scalar(m, p, q);
     }
+#endif
 }
 
 void matrix_xformPoint(Matrix *m, Point *p, Point *q) {
     if (m != NULL && p != NULL && q != NULL) {
-        Point tmp = *p;  // Copy the input point p into tmp
-        q->val[0] = m->m[0][0] * tmp.val[0] + m->m[0][1] * tmp.val[1] +
-                    m->m[0][2] * tmp.val[2] + m->m[0][3] * tmp.val[3];
-        q->val[1] = m->m[1][0] * tmp.val[0] + m->m[1][1] * tmp.val[1] +
-                    m->m[1][2] * tmp.val[2] + m->m[1][3] * tmp.val[3];
-        q->val[2] = m->m[2][0] * tmp.val[0] + m->m[2][1] * tmp.val[1] +
-                    m->m[2][2] * tmp.val[2] + m->m[2][3] * tmp.val[3];
-        q->val[3] = m->m[3][0] * tmp.val[0] + m->m[3][1] * tmp.val[1] +
-                    m->m[3][2] * tmp.val[2] + m->m[3][3] * tmp.val[3];
+        transform_point(m, p->val, q->val);
     }
 }
 
 
 void matrix_xformVector(Matrix *m, Vector *p, Vector *q) {
     if (m != NULL && p != NULL && q != NULL) {
-        Vector tmp = *p;  // Copy the input vector p into tmp
-        q->val[0] = m->m[0][0] * tmp.val[0] + m->m[0][1] * tmp.val[1] +
-                    m->m[0][2] * tmp.val[2] + m->m[0][3] * tmp.val[3];
-        q->val[1] = m->m[1][0] * tmp.val[0] + m->m[1][1] * tmp.val[1] +
-                    m->m[1][2] * tmp.val[2] + m->m[1][3] * tmp.val[3];
-        q->val[2] = m->m[2][0] * tmp.val[0] + m->m[2][1] * tmp.val[1] +
-                    m->m[2][2] * tmp.val[2] + m->m[2][3] * tmp.val[3];
-        q->val[3] = m->m[3][0] * tmp.val[0] + m->m[3][1] * tmp.val[1] +
-                    m->m[3][2] * tmp.val[2] + m->m[3][3] * tmp.val[3];
+        transform_point(m, p->val, q->val);
     }
 }
 
+#if !defined(TRANSFORM_AVX) && !defined(TRANSFORM_SSE2)
+// Number of points the scalar matrix_xformPoints converts to SoA form at a
+// time, so that an auto-vectorizing compiler can work on whole columns.
+#define XFORM_BLOCK 64
+#endif
 
-void matrix_xformPolygon(Matrix *m, Polygon *p) {
-    if (m != NULL && p != NULL) {
-        for (int i = 0; i < p->nVertex; i++) {
-            matrix_xformPoint(m, &p->vertex[i], &p->vertex[i]);
-            point_normalize(&p->vertex[i]);
+void matrix_xformPoints(const Matrix *m, const Point *in, Point *out, int n,
+                        int divide) {
+    if (m == NULL || in == NULL || out == NULL) {
+        return;
+    }
+
+    if (m->kind == MatrixIdentity || m->kind == MatrixTranslate || m->kind == MatrixScale) {
+        for (int i = 0; i < n; i++) {
+            transform_special(m, in[i].val, out[i].val);
+            if (divide) {
+                transform_divide(out[i].val);
+            }
         }
+        return;
+    }
+
+#if defined(TRANSFORM_AVX) || defined(TRANSFORM_SSE2)
+    // the matrix columns are set up once for the whole run
+    XformColumns c;
+    transform_columns(m, &c);
+    for (int i = 0; i < n; i++) {
+        transform_apply(&c, in[i].val, out[i].val, divide);
+    }
+#else
+    const double m00 = m->m[0][0], m01 = m->m[0][1], m02 = m->m[0][2], m03 = m->m[0][3];
+    const double m10 = m->m[1][0], m11 = m->m[1][1], m12 = m->m[1][2], m13 = m->m[1][3];
+    const double m20 = m->m[2][0], m21 = m->m[2][1], m22 = m->m[2][2], m23 = m->m[2][3];
+    const double m30 = m->m[3][0], m31 = m->m[3][1], m32 = m->m[3][2], m33 = m->m[3][3];
+    Coord x[XFORM_BLOCK], y[XFORM_BLOCK], z[XFORM_BLOCK], w[XFORM_BLOCK];
+
+    for (int start = 0; start < n; start += XFORM_BLOCK) {
+        int count = n - start < XFORM_BLOCK ? n - start : XFORM_BLOCK;
+        const Point *src = in + start;
+        Point *dst = out + start;
+
+        // the whole block is read before any of it is written, so in and out
+        // may be the same array
+        for (int i = 0; i < count; i++) {
+            x[i] = src[i].val[0];
+            y[i] = src[i].val[1];
+            z[i] = src[i].val[2];
+            w[i] = src[i].val[3];
+        }
+
+        // straight-line arithmetic over the SoA block, same operation order as
+        // matrix_xformPoint followed by point_normalize; h is left alone when
+        // the h row of m is 0 0 0 1
+        if (m->kind != MatrixProjective) {
+            for (int i = 0; i < count; i++) {
+                double px = x[i], py = y[i], pz = z[i], pw = w[i];
+                x[i] = m00 * px + m01 * py + m02 * pz + m03 * pw;
+                y[i] = m10 * px + m11 * py + m12 * pz + m13 * pw;
+                z[i] = m20 * px + m21 * py + m22 * pz + m23 * pw;
+            }
+        } else {
+            for (int i = 0; i < count; i++) {
+                double px = x[i], py = y[i], pz = z[i], pw = w[i];
+                x[i] = m00 * px + m01 * py + m02 * pz + m03 * pw;
+                y[i] = m10 * px + m11 * py + m12 * pz + m13 * pw;
+                z[i] = m20 * px + m21 * py + m22 * pz + m23 * pw;
+                w[i] = m30 * px + m31 * py + m32 * pz + m33 * pw;
+            }
+        }
+        if (divide) {
+            for (int i = 0; i < count; i++) {
+                // dividing by 1 leaves a point with h == 0 unchanged
+                double hw = w[i];
+                double h = hw != 0.0 ? hw : 1.0;
+                x[i] = x[i] / h;
+                y[i] = y[i] / h;
+                w[i] = hw != 0.0 ? 1.0 : hw;
+            }
+        }
+
+        for (int i = 0; i < count; i++) {
+            dst[i].val[0] = x[i];
+            dst[i].val[1] = y[i];
+            dst[i].val[2] = z[i];
+            dst[i].val[3] = w[i];
+        }
+    }
+#endif
+}
+
+void matrix_xformPolygon(Matrix *m, Polygon *p) {
+    if (m != NULL && p != NULL && p->vertex != NULL) {
+        matrix_xformPoints(m, p->vertex, p->vertex, p->nVertex, 1);
     }
 }
 
 void matrix_xformPolyline(Matrix *m, Polyline *p) {
-    if (m != NULL && p != NULL) {
-        for (int i = 0; i < p->numVertex; i++) {
-            matrix_xformPoint(m, &p->vertex[i], &p->vertex[i]);
-            point_normalize(&p->vertex[i]);
-        }
+    if (m != NULL && p != NULL && p->vertex != NULL) {
+        matrix_xformPoints(m, p->vertex, p->vertex, p->numVertex, 1);
     }
 }
 
@@ -214,6 +644,7 @@ void matrix_scale2D(Matrix *m, double sx, double sy) {
     matrix_identity(&scale);
     scale.m[0][0] = sx;
     scale.m[1][1] = sy;
+    scale.kind = MatrixScale;
     matrix_multiply(&scale, m, m);
 }
 
@@ -224,6 +655,7 @@ void matrix_rotateZ(Matrix *m, double cth, double sth) {
     rotate.m[0][1] = -sth;
     rotate.m[1][0] = sth;
     rotate.m[1][1] = cth;
+    rotate.kind = MatrixRigid;
     matrix_multiply(&rotate, m, m);
 }
 
@@ -232,6 +664,7 @@ void matrix_translate2D(Matrix *m, double tx, double ty) {
     matrix_identity(&translate);
     translate.m[0][3] = tx;
     translate.m[1][3] = ty;
+    translate.kind = MatrixTranslate;
     matrix_multiply(&translate, m, m);
 }
 
@@ -240,6 +673,7 @@ void matrix_shear2D(Matrix *m, double shx, double shy) {
     matrix_identity(&shear);
     shear.m[0][1] = shx;
     shear.m[1][0] = shy;
+    shear.kind = MatrixAffine;
     matrix_multiply(&shear, m, m);
 }
 
@@ -251,6 +685,7 @@ void matrix_translate(Matrix *m, double tx, double ty, double tz) {
     translate.m[0][3] = tx;
     translate.m[1][3] = ty;
     translate.m[2][3] = tz;
+    translate.kind = MatrixTranslate;
     matrix_multiply(&translate, m, m);
 }
 
@@ -260,6 +695,7 @@ void matrix_scale(Matrix *m, double sx, double sy, double sz) {
     scale.m[0][0] = sx;
     scale.m[1][1] = sy;
     scale.m[2][2] = sz;
+    scale.kind = MatrixScale;
     matrix_multiply(&scale, m, m);
 }
 
@@ -270,6 +706,7 @@ void matrix_rotateX(Matrix *m, double cth, double sth) {
     rotate.m[1][2] = -sth;
     rotate.m[2][1] = sth;
     rotate.m[2][2] = cth;
+    rotate.kind = MatrixRigid;
     matrix_multiply(&rotate, m, m);
 }
 
@@ -290,6 +727,7 @@ void matrix_rotateXYZ(Matrix *m, Vector *u, Vector *v, Vector *w) {
         rotate.m[1][i] = v->val[i];
         rotate.m[2][i] = w->val[i];
     }
+    rotate.kind = MatrixRigid;
     matrix_multiply(&rotate, m, m);
 }
 
@@ -298,6 +736,7 @@ void matrix_shearZ(Matrix *m, double shx, double shy) {
     matrix_identity(&shear);
     shear.m[0][2] = shx;
     shear.m[1][2] = shy;
+    shear.kind = MatrixAffine;
     matrix_multiply(&shear, m, m);
 }
 
@@ -305,5 +744,6 @@ void matrix_perspective(Matrix *m, double d) {
     Matrix perspective = {0};
     matrix_identity(&perspective);
     perspective.m[3][2] = 1.0 / d;
+    perspective.kind = MatrixProjective;
     matrix_multiply(&perspective, m, m);
 }
\ No newline at end of file
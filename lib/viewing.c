@@ -1,4 +1,5 @@
 #include "../include/viewing.h"
+#include "../include/trace.h"
 #include <math.h>
 #include <stdio.h>
 
@@ -17,7 +18,6 @@ void matrix_setView2D(Matrix *vtm, View2D *view) {
   // Step 1: Translate the VRP to the origin
   // Since vrp is a point, its coordinates can be accessed with vrp.val
   matrix_translate2D(vtm, -view->vrp.val[0], -view->vrp.val[1]);
-  matrix_print(vtm, stdout);
 
   // Step 2: Rotate to align with the x-axis
   double length =
@@ -26,7 +26,6 @@ void matrix_setView2D(Matrix *vtm, View2D *view) {
   double sth = view->x.val[1] / length; // sine of the rotation angle
   matrix_rotateZ(vtm, cth,
                  -sth);
-  matrix_print(vtm, stdout);
 
   // Step 3: Scale the scene to fit the screen dimensions
   // The dx should fit across the width of the screen, and the height is scaled
@@ -35,10 +34,11 @@ void matrix_setView2D(Matrix *vtm, View2D *view) {
   double sy = -sx;
 
   matrix_scale2D(vtm, sx, sy);
-  matrix_print(vtm, stdout);
 
   matrix_translate2D(vtm, view->screenx / 2, view->screeny / 2);
-  matrix_print(vtm, stdout);
+  TRACE_FRAME("setView2D", "vrpx,vrpy,dx,screenx,screeny", view->vrp.val[0],
+              view->vrp.val[1], view->dx, view->screenx, view->screeny);
+  TRACE_FRAME_MATRIX("setView2D VTM", vtm);
 }
 
 void matrix_setView3D(Matrix *vtm, View3D *view) {
@@ -56,7 +56,6 @@ void matrix_setView3D(Matrix *vtm, View3D *view) {
   // Step 1: Translate the world so that the VRP is at the origin
   matrix_translate(vtm, -view->vrp.val[0], -view->vrp.val[1],
                    -view->vrp.val[2]);
-  matrix_print(vtm, stdout);
 
   // Step 2: Align the axes
   // Calculate the orthonormal basis for the camera
@@ -69,9 +68,8 @@ void matrix_setView3D(Matrix *vtm, View3D *view) {
 
   vector_copy(&v, &VUP);
   vector_normalize(&v);
-  vector_print(&u, stdout);
-  vector_print(&v, stdout);
-  vector_print(&w, stdout);
+  TRACE_FRAME("setView3D basis", "ux,uy,uz,vx,vy,vz,wx,wy,wz", u.val[0], u.val[1],
+              u.val[2], v.val[0], v.val[1], v.val[2], w.val[0], w.val[1], w.val[2]);
 
   // Create the rotation matrix using u, v, w
   Matrix rotation;
@@ -86,14 +84,11 @@ void matrix_setView3D(Matrix *vtm, View3D *view) {
   matrix_set(&rotation, 2, 1, w.val[1]);
   matrix_set(&rotation, 2, 2, w.val[2]);
   matrix_multiply(&rotation, vtm, vtm);
-  matrix_print(vtm, stdout);
 
   matrix_translate(vtm, 0, 0, view->d);
-  matrix_print(vtm, stdout);
 
   double B = view->b + view->d;
   matrix_scale(vtm, 2*view->d/(B*view->du), 2*view->d/(B*view->dv), 1/B);
-  matrix_print(vtm, stdout);
 
   double D = view->d / B;
   Matrix per;
@@ -101,10 +96,11 @@ void matrix_setView3D(Matrix *vtm, View3D *view) {
   matrix_set(&per, 3, 2, 1/D);
   matrix_set(&per, 3, 3, 0);
   matrix_multiply(&per, vtm, vtm);
-  matrix_print(vtm, stdout);
 
   matrix_scale2D(vtm, -view->screenx/2/D, -view->screeny/2/D);
-  matrix_print(vtm, stdout);
   matrix_translate(vtm, view->screenx/2, view->screeny/2, 0);
-  matrix_print(vtm, stdout);
+  TRACE_FRAME("setView3D", "vrpx,vrpy,vrpz,d,du,dv,f,b", view->vrp.val[0],
+              view->vrp.val[1], view->vrp.val[2], view->d, view->du, view->dv,
+              view->f, view->b);
+  TRACE_FRAME_MATRIX("setView3D VTM", vtm);
 }
@@ -3,6 +3,7 @@
 #include "../include/graphics.h"
 #include "../include/viewing.h"
 #include "../include/hierarchical_modeling.h"
+#include "../include/render_pool.h"
 
 Module *ship;
 
@@ -222,6 +223,8 @@ int main(int argc, char *argv[]) {
     DrawState *ds;
     char filename[256];
     int frame;
+    // every frame is the same size, so its buffers are recycled
+    RenderPool *pool = renderpool_create(360, 640);
 
 
     ship = module_create();
@@ -259,9 +262,9 @@ for (int i = 0; i < 10; i++) {
         matrix_setView3D(&vtm, &view);
         matrix_identity(&gtm);
 
-        // Create the image for this frame
-        src = image_create(360, 640);
-        ds = drawstate_create();
+        // Take this frame's image and drawstate from the pool
+        src = renderpool_image(pool);
+        ds = renderpool_drawstate(pool);
         ds->shade = ShadeFrame;
 
         // Draw the scene
@@ -271,12 +274,13 @@ for (int i = 0; i < 10; i++) {
         sprintf(filename, "creative_%03d.ppm", frame);
         image_write(src, filename);
 
-        // Free resources for this frame
-        image_free(src);
-        free(ds);
+        // Hand them back for the next frame
+        renderpool_releaseImage(pool, src);
+        renderpool_releaseDrawState(pool, ds);
     }
 
     // Clean up
+    renderpool_free(pool);
     module_delete(scene);
 
     return 0;
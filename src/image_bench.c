@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/image.h"
+
+// Benchmark for the framebuffer in lib/image.c: create a 4K image, reset it
+// and write it out as a PPM. The "before" numbers come from scalar_* copies of
+// the original code, which allocated every row on its own, cleared pixel by
+// pixel through the row pointers and wrote three bytes at a time; the "after"
+// numbers from the library, which keeps the pixels in one aligned block. The
+// "planar" and "rgba8" numbers come from the library with the image switched
+// to ImagePlanar and to ImageRGBA8 with 24-bit depth. The library clears
+// lazily, so its create and reset only flag the tiles of the image and its
+// write puts out cleared tiles without reading them. The alpha and depth
+// clears, which only touch one channel, are timed for every layout as well.
+//
+// usage: image_bench [iterations] [output file, /dev/null by default]
+
+#define BENCH_ROWS 2160
+#define BENCH_COLS 3840
+
+// The "before" copies are kept out of line so that, like the library calls,
+// they cannot be inlined into the timing loops.
+#define BENCH_NOINLINE __attribute__((noinline))
+
+// The original image_reset.
+static BENCH_NOINLINE void scalar_reset(Image *src) {
+    src->maxval = 255.0f;
+    for (int i = 0; i < src->rows; i++) {
+        for (int j = 0; j < src->cols; j++) {
+            src->data[i][j].rgb[0] = 0.0f;
+            src->data[i][j].rgb[1] = 0.0f;
+            src->data[i][j].rgb[2] = 0.0f;
+            src->data[i][j].a = 1.0f;
+            src->data[i][j].z = IMAGE_Z_CLEAR;
+        }
+    }
+}
+
+// The original image_create, with one malloc per row.
+static BENCH_NOINLINE Image *scalar_create(int rows, int cols) {
+    Image *img = (Image *)malloc(sizeof(Image));
+    if (img == NULL) {
+        return NULL;
+    }
+    image_init(img);
+    img->rows = rows;
+    img->cols = cols;
+    img->data = (FPixel **)malloc(rows * sizeof(FPixel *));
+    if (img->data == NULL) {
+        free(img);
+        return NULL;
+    }
+    for (int i = 0; i < rows; i++) {
+        img->data[i] = (FPixel *)malloc(cols * sizeof(FPixel));
+        if (img->data[i] == NULL) {
+            for (int j = 0; j < i; j++) {
+                free(img->data[j]);
+            }
+            free(img->data);
+            free(img);
+            return NULL;
+        }
+    }
+    scalar_reset(img);
+    return img;
+}
+
+static void scalar_free(Image *src) {
+    for (int i = 0; i < src->rows; i++) {
+        free(src->data[i]);
+    }
+    free(src->data);
+    free(src);
+}
+
+// The original image_write.
+static BENCH_NOINLINE int scalar_write(Image *src, char *filename) {
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+        return -1;
+    }
+    fprintf(fp, "P6\n");
+    fprintf(fp, "%d %d\n%d\n", src->cols, src->rows, 255);
+    for (int i = 0; i < src->rows; i++) {
+        for (int j = 0; j < src->cols; j++) {
+            unsigned char rgb[3];
+            rgb[0] = (unsigned char)(src->data[i][j].rgb[0] * 255);
+            rgb[1] = (unsigned char)(src->data[i][j].rgb[1] * 255);
+            rgb[2] = (unsigned char)(src->data[i][j].rgb[2] * 255);
+            fwrite(rgb, sizeof(unsigned char), 3, fp);
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+static double seconds(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Time for one create, reset and write with each step's share, in seconds.
+typedef struct {
+    double create, reset, write;
+} FrameTime;
+
+// image_create for other layouts: switching an empty image is free, so only
+// the storage of the layout gets allocated.
+static Image *layout_create(int rows, int cols, ImageLayout layout) {
+    Image *img = image_create(0, 0);
+    if (img == NULL) {
+        return NULL;
+    }
+    if (image_setLayout(img, layout) != 0 || image_alloc(img, rows, cols) != 0) {
+        image_free(img);
+        return NULL;
+    }
+    return img;
+}
+
+static Image *planar_create(int rows, int cols) {
+    return layout_create(rows, cols, ImagePlanar);
+}
+
+static Image *rgba8_create(int rows, int cols) {
+    return layout_create(rows, cols, ImageRGBA8);
+}
+
+// Run the frame iterations times through the given functions; the "before"
+// set frees with scalar_free, the library set with image_free.
+static void bench_frames(Image *(*create)(int, int), void (*reset)(Image *),
+                         int (*write)(Image *, char *), int library,
+                         char *output, long iterations, FrameTime *time) {
+    memset(time, 0, sizeof(FrameTime));
+    for (long it = 0; it < iterations; it++) {
+        double start = seconds();
+        Image *img = create(BENCH_ROWS, BENCH_COLS);
+        if (img == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        double created = seconds();
+        reset(img);
+        double cleared = seconds();
+        if (write(img, output) != 0) {
+            fprintf(stderr, "Cannot write %s\n", output);
+            exit(EXIT_FAILURE);
+        }
+        double written = seconds();
+        if (library) {
+            image_free(img);
+        } else {
+            scalar_free(img);
+        }
+        time->create += created - start;
+        time->reset += cleared - created;
+        time->write += written - cleared;
+    }
+    time->create /= iterations;
+    time->reset /= iterations;
+    time->write /= iterations;
+}
+
+// Time for one image_filla plus one image_fillz, in seconds.
+static double bench_clearChannels(Image *img, long iterations) {
+    double start = seconds();
+    for (long it = 0; it < iterations; it++) {
+        image_filla(img, 1.0f);
+        image_fillz(img, IMAGE_Z_CLEAR);
+    }
+    return (seconds() - start) / iterations;
+}
+
+// Non-zero if b, in any layout, holds the same pixels as a, made by
+// scalar_create; a has no tile flags, so its rows are read directly.
+static int same_pixels(Image *a, Image *b) {
+    for (int i = 0; i < a->rows; i++) {
+        for (int j = 0; j < a->cols; j++) {
+            FPixel p = a->data[i][j], q = image_getf(b, i, j);
+            if (memcmp(&p, &q, sizeof(FPixel)) != 0) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static void print_frame(const char *name, FrameTime *t, FrameTime *before) {
+    double total = t->create + t->reset + t->write;
+    double totalBefore = before->create + before->reset + before->write;
+    printf("%-12s %8.2f %8.2f %8.2f %8.2f ms   (%5.2fx)\n", name,
+           t->create * 1e3, t->reset * 1e3, t->write * 1e3, total * 1e3,
+           totalBefore / total);
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : 10;
+    char *output = argc > 2 ? argv[2] : "/dev/null";
+    FrameTime before, after, planar, rgba8;
+
+    if (iterations < 1) {
+        iterations = 1;
+    }
+    bench_frames(scalar_create, scalar_reset, scalar_write, 0, output,
+                 iterations, &before);
+    bench_frames(image_create, image_reset, image_write, 1, output,
+                 iterations, &after);
+    bench_frames(planar_create, image_reset, image_write, 1, output,
+                 iterations, &planar);
+    bench_frames(rgba8_create, image_reset, image_write, 1, output,
+                 iterations, &rgba8);
+
+    // every layout must leave the same pixels after drawing and a reset; the
+    // values drawn are ones that RGBA8 stores exactly
+    Image *a = scalar_create(BENCH_ROWS, BENCH_COLS);
+    Image *img[3] = {image_create(BENCH_ROWS, BENCH_COLS),
+                     planar_create(BENCH_ROWS, BENCH_COLS),
+                     rgba8_create(BENCH_ROWS, BENCH_COLS)};
+    if (a == NULL || img[0] == NULL || img[1] == NULL || img[2] == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    int same = 1;
+    for (int k = 0; k < 3; k++) {
+        same = same && same_pixels(a, img[k]);
+    }
+    float green = 51 / 255.0f;
+    for (int i = 0; i < BENCH_ROWS; i += 7) {
+        for (int j = 0; j < BENCH_COLS; j += 5) {
+            a->data[i][j].rgb[1] = green;
+            a->data[i][j].z = 2.0f;
+            for (int k = 0; k < 3; k++) {
+                image_setc(img[k], i, j, 1, green);
+                image_setz(img[k], i, j, 2.0f);
+            }
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        same = same && same_pixels(a, img[k]);
+    }
+    scalar_reset(a);
+    double clear[3];
+    for (int k = 0; k < 3; k++) {
+        image_reset(img[k]);
+        same = same && same_pixels(a, img[k]);
+        clear[k] = bench_clearChannels(img[k], iterations);
+        image_free(img[k]);
+    }
+    scalar_free(a);
+
+    printf("%d x %d image, %ld frames, written to %s\n", BENCH_COLS,
+           BENCH_ROWS, iterations, output);
+    printf("%-12s %8s %8s %8s %8s\n", "", "create", "reset", "write", "total");
+    print_frame("before", &before, &before);
+    print_frame("after", &after, &before);
+    print_frame("planar", &planar, &before);
+    print_frame("rgba8", &rgba8, &before);
+    printf("alpha and depth clear   after %.2f ms   planar %.2f ms   rgba8 %.2f ms\n",
+           clear[0] * 1e3, clear[1] * 1e3, clear[2] * 1e3);
+    printf("results %s\n", same ? "identical" : "DIFFER");
+    return same ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/transform.h"
+
+// Microbenchmark for the matrix kernels in lib/transform.c. The "before"
+// numbers come from scalar_* copies of the original loops, the "after" numbers
+// from the library, which uses AVX or SSE2 when the build targets them.
+//
+// usage: matrix_bench [iterations]
+
+#define NMATRIX 64
+#define NPOINT 1024
+
+// The "before" copies are kept out of line so that, like the library calls,
+// they cannot be inlined into the timing loops.
+#define BENCH_NOINLINE __attribute__((noinline))
+
+// The original scalar matrix_multiply, including the copy through matrix_copy.
+static BENCH_NOINLINE void scalar_multiply(Matrix *left, Matrix *right, Matrix *m) {
+    Matrix temp;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            double sum = 0.0;
+            for (int k = 0; k < 4; k++) {
+                sum += left->m[i][k] * right->m[k][j];
+            }
+            temp.m[i][j] = sum;
+        }
+    }
+    matrix_copy(m, &temp);
+}
+
+// The original scalar matrix_xformPoint.
+static BENCH_NOINLINE void scalar_xformPoint(Matrix *m, Point *p, Point *q) {
+    Point tmp = *p;
+    q->val[0] = m->m[0][0] * tmp.val[0] + m->m[0][1] * tmp.val[1] +
+                m->m[0][2] * tmp.val[2] + m->m[0][3] * tmp.val[3];
+    q->val[1] = m->m[1][0] * tmp.val[0] + m->m[1][1] * tmp.val[1] +
+                m->m[1][2] * tmp.val[2] + m->m[1][3] * tmp.val[3];
+    q->val[2] = m->m[2][0] * tmp.val[0] + m->m[2][1] * tmp.val[1] +
+                m->m[2][2] * tmp.val[2] + m->m[2][3] * tmp.val[3];
+    q->val[3] = m->m[3][0] * tmp.val[0] + m->m[3][1] * tmp.val[1] +
+                m->m[3][2] * tmp.val[2] + m->m[3][3] * tmp.val[3];
+}
+
+static double seconds(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Chain multiplies through the matrix set so no call can be skipped.
+static double bench_multiply(void (*mul)(Matrix *, Matrix *, Matrix *),
+                             Matrix *mats, long iterations, Matrix *result) {
+    double start = seconds();
+    matrix_identity(result);
+    for (long it = 0; it < iterations; it++) {
+        for (int i = 0; i < NMATRIX; i++) {
+            mul(&mats[i], result, result);
+        }
+        // keep the values bounded
+        if ((it & 63) == 63) {
+            matrix_identity(result);
+        }
+    }
+    return iterations * (double)NMATRIX / (seconds() - start);
+}
+
+// Transform the point set in place, the way the draw path does.
+static double bench_xform(void (*xform)(Matrix *, Point *, Point *),
+                          Matrix *m, Point *src, Point *pts, long iterations) {
+    double start = seconds();
+    for (long it = 0; it < iterations; it++) {
+        if ((it & 63) == 0) {
+            memcpy(pts, src, sizeof(Point) * NPOINT);
+        }
+        for (int i = 0; i < NPOINT; i++) {
+            xform(m, &pts[i], &pts[i]);
+        }
+    }
+    return iterations * (double)NPOINT / (seconds() - start);
+}
+
+// Same work through the batched matrix_xformPoints.
+static double bench_xformBatch(Matrix *m, Point *src, Point *pts, long iterations) {
+    double start = seconds();
+    for (long it = 0; it < iterations; it++) {
+        if ((it & 63) == 0) {
+            memcpy(pts, src, sizeof(Point) * NPOINT);
+        }
+        matrix_xformPoints(m, pts, pts, NPOINT, 0);
+    }
+    return iterations * (double)NPOINT / (seconds() - start);
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : 20000;
+    Matrix mats[NMATRIX], before, after, m;
+    Point *src = (Point *)malloc(sizeof(Point) * NPOINT);
+    Point *ptsBefore = (Point *)malloc(sizeof(Point) * NPOINT);
+    Point *ptsAfter = (Point *)malloc(sizeof(Point) * NPOINT);
+    Point *ptsBatch = (Point *)malloc(sizeof(Point) * NPOINT);
+    if (src == NULL || ptsBefore == NULL || ptsAfter == NULL || ptsBatch == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // near-orthonormal matrices so repeated products stay finite
+    srand(42);
+    for (int i = 0; i < NMATRIX; i++) {
+        matrix_identity(&mats[i]);
+        matrix_rotateZ(&mats[i], 0.6, 0.8);
+        matrix_rotateX(&mats[i], 0.8, -0.6);
+        matrix_translate(&mats[i], rand() % 7 - 3, rand() % 7 - 3, rand() % 7 - 3);
+    }
+    for (int i = 0; i < NPOINT; i++) {
+        point_set3D(&src[i], rand() % 100 - 50, rand() % 100 - 50, rand() % 100 - 50);
+    }
+    matrix_identity(&m);
+    matrix_rotateZ(&m, 0.6, 0.8);
+    matrix_scale(&m, 0.999, 1.001, 1.0);
+
+    double mulBefore = bench_multiply(scalar_multiply, mats, iterations, &before);
+    double mulAfter = bench_multiply(matrix_multiply, mats, iterations, &after);
+    double xfBefore = bench_xform(scalar_xformPoint, &m, src, ptsBefore, iterations / 16);
+    double xfAfter = bench_xform(matrix_xformPoint, &m, src, ptsAfter, iterations / 16);
+    double xfBatch = bench_xformBatch(&m, src, ptsBatch, iterations / 16);
+
+    int same = memcmp(before.m, after.m, sizeof(before.m)) == 0 &&
+               memcmp(ptsBefore, ptsAfter, sizeof(Point) * NPOINT) == 0 &&
+               memcmp(ptsBefore, ptsBatch, sizeof(Point) * NPOINT) == 0;
+
+    printf("matrix multiplies/s   before %12.0f   after %12.0f   (%.2fx)\n",
+           mulBefore, mulAfter, mulAfter / mulBefore);
+    printf("points transformed/s  before %12.0f   after %12.0f   (%.2fx)\n",
+           xfBefore, xfAfter, xfAfter / xfBefore);
+    printf("points transformed/s  batched %11.0f   (%.2fx)\n", xfBatch,
+           xfBatch / xfBefore);
+    printf("results %s\n", same ? "identical" : "DIFFER");
+
+    free(src);
+    free(ptsBefore);
+    free(ptsAfter);
+    free(ptsBatch);
+    return same ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../include/hierarchical_modeling.h"
+#include "../include/viewing.h"
+
+// Benchmark for building hierarchies in lib/hierarchical_modeling.c. A chain
+// of modules, each holding a line and the module below it, is built bottom up
+// the way a scene graph loader would, and its bounds are then taken once, as
+// module_draw would. This is done for n and 4n levels. Building costs a
+// constant amount per element, so the larger chain should take about four
+// times as long; the bench fails if it takes more than twice that. Each chain
+// is then drawn once as the prototype of an instancing element, which
+// module_draw flattens with module_compile. Deep chains overflow the C stack
+// if either of them recurses once per level.
+//
+// usage: module_bench [levels, 20000 by default]
+
+// Longer than this, in seconds, and the 4n chain has to scale to count as a
+// pass; shorter times are mostly noise.
+#define BENCH_MIN_SECONDS 0.05
+
+static double seconds(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Time to build a chain of n modules bottom up and take its bounds, in
+// seconds. The build alone is returned through build, and the time to draw
+// the chain as an instanced prototype through draw.
+static double bench_chain(int n, double *build, double *draw) {
+    Module **level = (Module **)malloc(sizeof(Module *) * n);
+    if (level == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double start = seconds();
+    for (int i = 0; i < n; i++) {
+        Line l;
+        line_set2D(&l, 0.0, 0.0, 1.0, 1.0);
+        level[i] = module_create();
+        module_line(level[i], &l);
+        if (i > 0) {
+            module_translate2D(level[i], 1.0, 0.0);
+            module_module(level[i], level[i - 1]);
+        }
+    }
+    double built = seconds();
+    Bounds *b = module_bounds(level[n - 1]);
+    double bounded = seconds();
+
+    // every level moves the one below it right by one
+    if (b->empty || b->max[0] != n) {
+        printf("bounds of the %d chain are wrong: x up to %.1f\n", n, b->max[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // one instance of the chain, in a 100 x 100 image around the origin
+    Module *scene = module_create();
+    Matrix xform;
+    matrix_identity(&xform);
+    module_instances(scene, level[n - 1], &xform, 1);
+    Image *src = image_create(100, 100);
+    View2D view;
+    Matrix VTM, GTM;
+    point_set2D(&view.vrp, 0.0, 0.0);
+    vector_set(&view.x, 1.0, 0.0, 0.0);
+    view.dx = 100.0;
+    view.screenx = 100;
+    view.screeny = 100;
+    matrix_setView2D(&VTM, &view);
+    matrix_identity(&GTM);
+    DrawState *ds = drawstate_create();
+    double drawStart = seconds();
+    module_draw(scene, &VTM, &GTM, ds, NULL, src);
+    *draw = seconds() - drawStart;
+    free(ds);
+    image_free(src);
+    module_delete(scene);
+
+    for (int i = 0; i < n; i++) {
+        module_delete(level[i]);
+    }
+    free(level);
+
+    *build = built - start;
+    return bounded - start;
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 20000;
+    double build, build4, total, total4, draw, draw4;
+
+    if (n < 2) {
+        fprintf(stderr, "usage: %s [levels]\n", argv[0]);
+        return 1;
+    }
+
+    total = bench_chain(n, &build, &draw);
+    total4 = bench_chain(4 * n, &build4, &draw4);
+
+    printf("chain of %7d: build %8.2f ms   build + bounds %8.2f ms   "
+           "instanced draw %8.2f ms\n", n, build * 1e3, total * 1e3, draw * 1e3);
+    printf("chain of %7d: build %8.2f ms   build + bounds %8.2f ms   "
+           "instanced draw %8.2f ms\n", 4 * n, build4 * 1e3, total4 * 1e3,
+           draw4 * 1e3);
+    int scales = total4 < BENCH_MIN_SECONDS || total4 < 8.0 * total;
+    printf("4x the levels takes %.1fx the time: %s\n", total4 / total,
+           scales ? "linear" : "SUPERLINEAR");
+
+    return scales ? 0 : 1;
+}
@@ -0,0 +1,222 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../include/geometry_float.h"
+#include "../include/hierarchical_modeling.h"
+#include "../include/viewing.h"
+
+// Compares the float geometry pipeline with the double one. Every vertex of a
+// scene is taken through LTM, GTM and VTM twice, once with Point and Matrix
+// and once with PointF and MatrixF, and the screen positions are compared.
+// The scenes use the views and module layout of cube.c and spaceship.c, plus
+// the spaceship scene moved far from the origin, where float runs out of bits.
+//
+// usage: precision
+
+typedef struct {
+    long vertices;   // vertices projected
+    long moved;      // vertices whose float pixel differs from the double one
+    double maxError; // largest distance between the two positions, in pixels
+} PrecisionStats;
+
+// Project p both ways and record the difference.
+static void compare_vertex(Point *p, Matrix *m, MatrixF *mf, PrecisionStats *stats) {
+    Point q;
+    PointF pf, qf;
+
+    matrix_xformPoint(m, p, &q);
+    point_normalize(&q);
+    pointf_fromPoint(&pf, p);
+    matrixf_xformPoints(mf, &pf, &qf, 1, 1);
+
+    double dx = q.val[0] - qf.val[0];
+    double dy = q.val[1] - qf.val[1];
+    double error = sqrt(dx * dx + dy * dy);
+    if (error > stats->maxError) {
+        stats->maxError = error;
+    }
+    if ((int)q.val[0] != (int)qf.val[0] || (int)q.val[1] != (int)qf.val[1]) {
+        stats->moved++;
+    }
+    stats->vertices++;
+}
+
+// Walk md like module_draw. GTM and GTMf are the double and float transforms
+// into world coordinates; the float one is composed in float all the way
+// down, the way a float pipeline would build it.
+static void compare_module(Module *md, Matrix *VTM, MatrixF *VTMf, Matrix *GTM,
+                           MatrixF *GTMf, PrecisionStats *stats) {
+    Matrix LTM, all, sub;
+    MatrixF LTMf, allf, subf, mf;
+    matrix_identity(&LTM);
+    matrixf_fromMatrix(&LTMf, &LTM);
+
+    for (Element *e = md->head; e != NULL; e = e->next) {
+        // VTM * GTM * LTM for the primitives of this element
+        matrix_multiply(GTM, &LTM, &all);
+        matrix_multiply(VTM, &all, &all);
+        matrixf_multiply(GTMf, &LTMf, &allf);
+        matrixf_multiply(VTMf, &allf, &allf);
+
+        switch (e->type) {
+        case ObjPoint:
+            compare_vertex((Point *)e->obj, &all, &allf, stats);
+            break;
+        case ObjLine: {
+            Line *l = (Line *)e->obj;
+            compare_vertex(&l->a, &all, &allf, stats);
+            compare_vertex(&l->b, &all, &allf, stats);
+            break;
+        }
+        case ObjPolyline: {
+            Polyline *p = (Polyline *)e->obj;
+            for (int i = 0; i < p->numVertex; i++) {
+                compare_vertex(&p->vertex[i], &all, &allf, stats);
+            }
+            break;
+        }
+        case ObjPolygon: {
+            Polygon *p = (Polygon *)e->obj;
+            for (int i = 0; i < p->nVertex; i++) {
+                compare_vertex(&p->vertex[i], &all, &allf, stats);
+            }
+            break;
+        }
+        case ObjIdentity:
+            matrix_identity(&LTM);
+            matrixf_fromMatrix(&LTMf, &LTM);
+            break;
+        case ObjMatrix:
+            matrix_multiply((Matrix *)e->obj, &LTM, &LTM);
+            matrixf_fromMatrix(&mf, (Matrix *)e->obj);
+            matrixf_multiply(&mf, &LTMf, &LTMf);
+            break;
+        case ObjModule:
+            matrix_multiply(GTM, &LTM, &sub);
+            matrixf_multiply(GTMf, &LTMf, &subf);
+            compare_module((Module *)e->obj, VTM, VTMf, &sub, &subf, stats);
+            break;
+        case ObjInstances: {
+            Instances *inst = (Instances *)e->obj;
+            for (int i = 0; i < inst->n; i++) {
+                matrix_multiply(&inst->xforms[i], &LTM, &sub);
+                matrix_multiply(GTM, &sub, &sub);
+                matrixf_fromMatrix(&mf, &inst->xforms[i]);
+                matrixf_multiply(&mf, &LTMf, &subf);
+                matrixf_multiply(GTMf, &subf, &subf);
+                compare_module(inst->proto, VTM, VTMf, &sub, &subf, stats);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+static void report(const char *name, Module *scene, View3D *view) {
+    Matrix VTM, GTM;
+    MatrixF VTMf, GTMf;
+    PrecisionStats stats = {0, 0, 0.0};
+
+    matrix_setView3D(&VTM, view);
+    matrix_identity(&GTM);
+    matrixf_fromMatrix(&VTMf, &VTM);
+    matrixf_fromMatrix(&GTMf, &GTM);
+    compare_module(scene, &VTM, &VTMf, &GTM, &GTMf, &stats);
+
+    printf("%-12s %8ld vertices   %6ld in a different pixel (%5.2f%%)   max error %.6f px\n",
+           name, stats.vertices, stats.moved,
+           stats.vertices > 0 ? 100.0 * stats.moved / stats.vertices : 0.0,
+           stats.maxError);
+}
+
+// A ship with the layout of the one in spaceship.c, built from cubes.
+static Module *create_ship(void) {
+    Module *ship = module_create();
+    Module *parts[4];
+    double scale[4][3] = {{1.0, 3.0, 1.0}, {0.7, 1.8, 0.7}, {0.8, 0.8, 0.8}, {0.7, 1.5, 0.7}};
+    double offset[4] = {0.0, -2.0, 1.5, -4.7};
+
+    for (int i = 0; i < 4; i++) {
+        parts[i] = module_create();
+        module_scale(parts[i], scale[i][0], scale[i][1], scale[i][2]);
+        module_translate(parts[i], 0, offset[i], 0);
+        module_cube(parts[i], 0);
+        module_module(ship, parts[i]);
+    }
+    return ship;
+}
+
+// Three formations of three ships, placed like the ones in spaceship.c and
+// shifted by (shift, shift, shift).
+static Module *create_fleet(Module *ship, double shift) {
+    Module *scene = module_create();
+    double place[3][5] = {{30, -3, 3, 3, 20.0}, {-30, 3, 3, -3, 50}, {0, 3, -3, 3, -20}};
+
+    for (int f = 0; f < 3; f++) {
+        Matrix xforms[3], rotate, translate;
+        double angle = place[f][4];
+        for (int i = 0; i < 3; i++) {
+            matrix_identity(&rotate);
+            matrix_rotateX(&rotate, cos(angle), sin(angle));
+            matrix_identity(&translate);
+            matrix_translate(&translate, place[f][1] * i, place[f][2] * i, place[f][3] * (i + 1));
+            if (i == 0) {
+                matrix_copy(&xforms[i], &rotate);
+            } else {
+                matrix_multiply(&rotate, &xforms[i - 1], &xforms[i]);
+            }
+            matrix_multiply(&translate, &xforms[i], &xforms[i]);
+        }
+        Module *formation = module_create();
+        module_instances(formation, ship, xforms, 3);
+        module_identity(scene);
+        module_translate(scene, place[f][0] + shift, shift, shift);
+        module_module(scene, formation);
+    }
+    return scene;
+}
+
+int main(void) {
+    View3D view;
+
+    // cube.c
+    Module *cube = module_create();
+    module_cube(cube, 0);
+    point_set3D(&view.vrp, 2.0, 2.5, 2.0);
+    vector_set(&view.vpn, -2.0, -2.5, -0.5);
+    vector_set(&view.vup, 0.0, 0.0, 1.0);
+    view.d = 0.5;
+    view.du = 2.0;
+    view.dv = 2.0;
+    view.f = 0.0;
+    view.b = 10.0;
+    view.screenx = 600;
+    view.screeny = 600;
+    report("cube", cube, &view);
+
+    // spaceship.c, then the same scene and view 10^4 and 10^5 units out
+    Module *ship = create_ship();
+    double shifts[3] = {0.0, 1e4, 1e5};
+    const char *names[3] = {"spaceship", "far 1e4", "far 1e5"};
+    for (int i = 0; i < 3; i++) {
+        Module *fleet = create_fleet(ship, shifts[i]);
+        point_set3D(&view.vrp, 10 + shifts[i], 10 + shifts[i], 40 + shifts[i]);
+        vector_set(&view.vpn, 0, 0, -1);
+        vector_set(&view.vup, 0, 1, 0);
+        view.d = 10;
+        view.du = 20;
+        view.dv = 15;
+        view.f = 1;
+        view.b = 100;
+        view.screenx = 640;
+        view.screeny = 360;
+        report(names[i], fleet, &view);
+        module_delete(fleet);
+    }
+
+    module_delete(ship);
+    module_delete(cube);
+    return 0;
+}
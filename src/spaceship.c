@@ -203,13 +203,24 @@ Module* create_spaceship(Module *ship) {
 
 void create_formation(Module *mod, double tx, double ty, double tz, double angle) {
     int i;
+    Matrix xforms[3];
+    Matrix rotate, translate;
 
+    // each ship is placed relative to the one before it
     Module *formation = module_create();
     for (i = 0; i < 3; i++) {
-        module_rotateX(formation, cos(angle), sin(angle));
-        module_translate(formation, tx * i, ty * i, tz * (i + 1));
-        module_module(formation, ship);
+        matrix_identity(&rotate);
+        matrix_rotateX(&rotate, cos(angle), sin(angle));
+        matrix_identity(&translate);
+        matrix_translate(&translate, tx * i, ty * i, tz * (i + 1));
+        if (i == 0) {
+            matrix_copy(&xforms[i], &rotate);
+        } else {
+            matrix_multiply(&rotate, &xforms[i - 1], &xforms[i]);
+        }
+        matrix_multiply(&translate, &xforms[i], &xforms[i]);
     }
+    module_instances(formation, ship, xforms, 3);
     module_module(mod, formation);
 }
 
@@ -219,6 +230,8 @@ int main(int argc, char *argv[]) {
     View3D view;
     Matrix vtm, gtm;
     DrawState *ds;
+    DrawStats stats;
+    DepthStats depth;
 
     ship = module_create();
     create_spaceship(ship);    
@@ -254,7 +267,15 @@ int main(int argc, char *argv[]) {
     ds->shade = ShadeFrame;
 
     // Draw the scene
+    drawstats_reset();
+    depthstats_reset();
     module_draw(scene, &vtm, &gtm, ds, NULL, src);
+    drawstats_get(&stats);
+    depthstats_get(&depth);
+    printf("%ld matrix composes for %ld vertex transforms\n",
+           stats.composes, stats.vertexTransforms);
+    printf("%ld of %ld depth-tested pixels rejected\n", depth.rejected,
+           depth.tested);
 
     // Write out the scene
     image_write(src, "spaceships_formation.ppm");